@@ -13,6 +13,10 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -138,4 +142,8 @@ print_stats (void)
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  page_print_stats ();
+  swap_print_stats ();
+#endif
 }
@@ -20,6 +20,24 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Dynamic tick.  While the CPU idles the periodic tick is stopped
+   and the PIT counts down once, ONESHOT_CYCLES, to the next
+   deadline.  The time spent that way is folded back into TICKS,
+   CYCLE_CARRY holding what is left of a tick.  SHOT_PENDING is set
+   when the shot's interrupt is still to be delivered although its
+   span was already folded in, so that it does not count again.
+   The counter is 16 bits wide, so a shot lasts at most
+   UINT16_MAX / TICK_CYCLES ticks, 5 at the default TIMER_FREQ:
+   an idle CPU still wakes up every 50 ms or so and, finding no
+   deadline due, arms the next shot. */
+static bool tickless;
+static bool shot_pending;
+static uint16_t oneshot_cycles;
+static unsigned cycle_carry;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -29,6 +47,7 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void timer_fold (unsigned cycles);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -165,11 +184,91 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, right before
+   it halts.  If no sleeper is due at the next tick, stops the
+   periodic tick and arms a one-shot interrupt for the earliest
+   deadline instead, as far as the PIT's 16-bit counter reaches.
+   The shot never spans a second boundary, where the MLFQS
+   statistics are updated. */
+void
+timer_idle (void) 
+{
+  int64_t deadline = thread_next_wakeup ();
+  int64_t second = (ticks / TIMER_FREQ + 1) * TIMER_FREQ;
+  int64_t delta;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  timer_resume ();
+  if (second < deadline)
+    deadline = second;
+  delta = deadline - ticks;
+  if (delta <= 1)
+    return;
+  if (delta > UINT16_MAX / TICK_CYCLES)
+    delta = UINT16_MAX / TICK_CYCLES;
+
+  oneshot_cycles = delta * TICK_CYCLES;
+  pit_configure_oneshot (0, oneshot_cycles);
+  tickless = true;
+}
+
+/* Goes back to the periodic tick if the idle thread stopped it,
+   accounting for the time that passed.  Called when a thread
+   other than idle is about to run. */
+void
+timer_resume (void) 
+{
+  uint16_t left;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!tickless)
+    return;
+
+  /* A count of zero or above the start means the shot already went
+     off, the counter wrapping past zero; its interrupt is still
+     pending. */
+  left = pit_read_counter (0);
+  if (left == 0 || left > oneshot_cycles)
+    {
+      timer_fold (oneshot_cycles);
+      shot_pending = true;
+    }
+  else
+    timer_fold (oneshot_cycles - left);
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  tickless = false;
+}
+
+/* Adds CYCLES PIT cycles to the tick count. */
+static void
+timer_fold (unsigned cycles) 
+{
+  cycle_carry += cycles;
+  ticks += cycle_carry / TICK_CYCLES;
+  cycle_carry %= TICK_CYCLES;
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
+  if (shot_pending)
+    {
+      /* The one-shot that timer_resume() already accounted for. */
+      shot_pending = false;
+      return;
+    }
+  if (tickless)
+    {
+      /* The one-shot went off: the whole span has passed. */
+      timer_fold (oneshot_cycles);
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      tickless = false;
+    }
+  else
+    ticks++;
   check_wakeup(timer_ticks());
   thread_tick ();
 }
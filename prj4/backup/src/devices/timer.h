@@ -24,6 +24,10 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Dynamic tick, for the idle thread. */
+void timer_idle (void);
+void timer_resume (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
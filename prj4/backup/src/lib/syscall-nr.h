@@ -32,7 +32,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Project 4 additional system call */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_VMSTAT                  /* Obtain paging statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
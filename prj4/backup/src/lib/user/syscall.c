@@ -207,4 +207,17 @@ int fibonacci(int n){
 
 int max_of_four_int(int a, int b, int c, int d){
   return syscall4 (SYS_MAX_FOUR, a, b, c, d);
-}
\ No newline at end of file
+}
+
+/* Project 4 additional system call */
+pid_t
+fork (void)
+{
+  return syscall0 (SYS_FORK);
+}
+
+void
+vmstat (struct vmstat *self, struct vmstat *total)
+{
+  syscall2 (SYS_VMSTAT, self, total);
+}
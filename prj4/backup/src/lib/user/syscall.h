@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -49,4 +50,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Project 4 additional system call */
+pid_t fork (void);
+void vmstat (struct vmstat *self, struct vmstat *total);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,16 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Paging statistics of one process or of the whole system, as
+   returned by the vmstat system call. */
+struct vmstat
+  {
+    long long minor_faults;     /* Faults served without I/O. */
+    long long major_faults;     /* Faults that read a file or swap. */
+    long long swap_ins;         /* Pages read from swap. */
+    long long swap_outs;        /* Pages written to swap. */
+    long long evictions;        /* Pages taken away to free frames. */
+    unsigned resident_pages;    /* Pages now in frames. */
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,36 @@
+/* Fills more memory than there are frames, so that the first page
+   is swapped out, then forks.  The child writes to that page and
+   the parent checks that its own copy still holds what it wrote
+   before the fork. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < SIZE; i += 4096)
+    buf[i] = 0x5a;
+  msg ("filled memory");
+
+  child = fork ();
+  if (child == 0)
+    {
+      buf[0] = 0x33;
+      exit (buf[0] == 0x33 && buf[4096] == 0x5a ? 0 : 1);
+    }
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0, "child wrote to swapped page");
+  for (i = 0; i < SIZE; i += 4096)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu is %02hhx", i, buf[i]);
+  msg ("parent's pages unchanged");
+}
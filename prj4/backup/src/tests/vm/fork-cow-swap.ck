@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow-swap) begin
+(fork-cow-swap) filled memory
+(fork-cow-swap) fork
+(fork-cow-swap) child wrote to swapped page
+(fork-cow-swap) parent's pages unchanged
+(fork-cow-swap) end
+EOF
+pass;
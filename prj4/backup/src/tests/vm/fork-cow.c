@@ -0,0 +1,67 @@
+/* Checks that after fork the data, bss and stack pages of parent
+   and child are private copies: a write by the child does not show
+   in the parent, and a write by the parent does not show in the
+   child. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char data[] = "original data";
+static char bss[4096];
+
+/* Spins until FILE exists. */
+static void
+wait_for_file (const char *file)
+{
+  int handle;
+
+  while ((handle = open (file)) == -1)
+    continue;
+  close (handle);
+}
+
+/* Returns true if DATA, BSS and STACK hold what they did at
+   fork time. */
+static bool
+unchanged (const char *stack)
+{
+  return !strcmp (data, "original data") && bss[0] == 0
+         && !strcmp (stack, "original stack");
+}
+
+void
+test_main (void)
+{
+  char stack[] = "original stack";
+  pid_t child;
+
+  /* Child writes, parent must not see it. */
+  child = fork ();
+  if (child == 0)
+    {
+      strlcpy (data, "child data", sizeof data);
+      bss[0] = 'c';
+      strlcpy (stack, "child stack", sizeof stack);
+      exit (!strcmp (data, "child data") && bss[0] == 'c'
+            && !strcmp (stack, "child stack") ? 0 : 1);
+    }
+  CHECK (child != -1, "fork child that writes");
+  CHECK (wait (child) == 0, "child sees its own writes");
+  CHECK (unchanged (stack), "parent's pages unchanged");
+
+  /* Parent writes, child must not see it. */
+  child = fork ();
+  if (child == 0)
+    {
+      wait_for_file ("written");
+      exit (unchanged (stack) ? 0 : 1);
+    }
+  CHECK (child != -1, "fork child that reads");
+  strlcpy (data, "parent data", sizeof data);
+  bss[0] = 'p';
+  strlcpy (stack, "parent stack", sizeof stack);
+  CHECK (create ("written", 0), "write in parent");
+  CHECK (wait (child) == 0, "child's pages unchanged");
+}
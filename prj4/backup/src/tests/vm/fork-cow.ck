@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) fork child that writes
+(fork-cow) child sees its own writes
+(fork-cow) parent's pages unchanged
+(fork-cow) fork child that reads
+(fork-cow) write in parent
+(fork-cow) child's pages unchanged
+(fork-cow) end
+EOF
+pass;
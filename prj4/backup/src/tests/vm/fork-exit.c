@@ -0,0 +1,62 @@
+/* Forks a child that forks a grandchild and then exits at once.
+   Once the child is gone, the grandchild faults in text and data
+   pages that nobody has touched yet and verifies their contents,
+   so those pages must come from the grandchild's own executable
+   rather than from the exited child's. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 4096)
+
+/* Read-only data lives in the text segment. */
+static const char ro_pages[SIZE] = { [0 ... SIZE - 1] = 0x5a };
+static char rw_pages[SIZE] = { [0 ... SIZE - 1] = 0xa5 };
+
+/* Spins until FILE exists. */
+static void
+wait_for_file (const char *file)
+{
+  int handle;
+
+  while ((handle = open (file)) == -1)
+    continue;
+  close (handle);
+}
+
+static void
+grandchild (void)
+{
+  size_t i;
+
+  wait_for_file ("go");
+  for (i = 0; i < SIZE; i++)
+    if (((const volatile char *) ro_pages)[i] != 0x5a)
+      fail ("text byte %zu is %02hhx", i, ro_pages[i]);
+  msg ("verified text pages");
+  for (i = 0; i < SIZE; i++)
+    if (((volatile char *) rw_pages)[i] != (char) 0xa5)
+      fail ("data byte %zu is %02hhx", i, rw_pages[i]);
+  msg ("verified data pages");
+  create ("done", 0);
+  exit (0);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  child = fork ();
+  if (child == 0)
+    {
+      if (fork () == 0)
+        grandchild ();
+      exit (0);
+    }
+  CHECK (child != -1, "fork child");
+  CHECK (wait (child) == 0, "wait for child");
+  CHECK (create ("go", 0), "create \"go\"");
+  wait_for_file ("done");
+}
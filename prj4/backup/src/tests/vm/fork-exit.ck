@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-exit) begin
+(fork-exit) fork child
+(fork-exit) wait for child
+(fork-exit) create "go"
+(fork-exit) verified text pages
+(fork-exit) verified data pages
+(fork-exit) end
+EOF
+pass;
@@ -0,0 +1,18 @@
+/* Calls munmap with mapping id 0, which no mmap returns, and
+   checks that the code and data of the process are still there
+   afterward. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char data[] = "still here";
+
+void
+test_main (void)
+{
+  munmap (0);
+  msg ("munmap mapping 0");
+  CHECK (!strcmp (data, "still here"), "data is intact");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-unmap-zero) begin
+(mmap-unmap-zero) munmap mapping 0
+(mmap-unmap-zero) data is intact
+(mmap-unmap-zero) end
+mmap-unmap-zero: exit(0)
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Writes one byte to each page of an untouched array and checks
+   that the vmstat system call reports the faults and the new
+   resident pages. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 16
+
+static char buf[PAGES * 4096];
+
+static long long
+faults (const struct vmstat *s)
+{
+  return s->minor_faults + s->major_faults;
+}
+
+void
+test_main (void)
+{
+  struct vmstat before, after, total;
+  size_t i;
+
+  vmstat (&before, &total);
+  CHECK (faults (&total) >= faults (&before), "system faults cover process");
+
+  for (i = 0; i < PAGES; i++)
+    buf[i * 4096] = i;
+
+  vmstat (&after, &total);
+  CHECK (faults (&after) > faults (&before), "fault counters moved");
+  CHECK (after.resident_pages >= before.resident_pages + PAGES,
+         "resident pages grew by at least %d", PAGES);
+  CHECK (total.resident_pages >= after.resident_pages,
+         "system resident pages cover process");
+}
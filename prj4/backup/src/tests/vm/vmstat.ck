@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vmstat) begin
+(vmstat) system faults cover process
+(vmstat) fault counters moved
+(vmstat) resident pages grew by at least 16
+(vmstat) system resident pages cover process
+(vmstat) end
+vmstat: exit(0)
+EOF
+pass;
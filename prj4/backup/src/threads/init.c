@@ -40,6 +40,7 @@
 
 /*  Project 4 */
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
 
 /* Page directory with kernel mappings only. */
@@ -63,6 +64,11 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pge (void);
+
+/* CPUID feature bit and CR4 bit for global pages. */
+#define CPUID_PGE (1 << 13)
+#define CR4_PGE (1 << 7)
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -133,9 +139,10 @@ main (void)
 
   /* Project 4 */
 #ifdef VM
-  frame_init();
   block_print_stats();
   init_swap_table();
+  page_init();
+  frame_cleaner_start();
 #endif
 
 
@@ -189,7 +196,7 @@ paging_init (void)
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | PTE_G;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -198,6 +205,28 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Let the kernel mappings, which every page directory shares,
+     survive the CR3 reload of each process switch.  The global
+     bit is ignored by CPUs without page global enable.  See
+     [IA32-v3a] 3.12 "Translation Lookaside Buffers (TLBs)". */
+  if (cpu_has_pge ())
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
+    }
+}
+
+/* Returns true if the CPU supports global pages, according to
+   CPUID.  See [IA32-v2a] "CPUID--CPU Identification". */
+static bool
+cpu_has_pge (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & CPUID_PGE) != 0;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -276,6 +305,16 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-wmlow"))
+        frame_low_watermark = atoi (value);
+      else if (!strcmp (name, "-wmhigh"))
+        frame_high_watermark = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-thrash"))
+        frame_thrash_rate = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -398,6 +437,12 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -wmlow=COUNT       Start cleaning below COUNT free user pages.\n"
+          "  -wmhigh=COUNT      Stop cleaning at COUNT free user pages.\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
+          "  -thrash=RATE       Suspend processes above RATE major faults/s.\n"
 #endif
           );
   shutdown_power_off ();
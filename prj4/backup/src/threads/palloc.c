@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,22 +25,31 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   The idle thread zeroes some free pages of each pool ahead of
+   time, so that PAL_ZERO requests can usually skip the memset. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *zeroed_map;          /* Free pages known to be zero. */
+    size_t zeroed_cnt;                  /* Number of bits set in zeroed_map. */
     uint8_t *base;                      /* Base of pool. */
   };
 
+/* Most free pages kept zeroed in each pool. */
+#define ZEROED_MAX 64
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static bool zero_free_page (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -60,6 +70,12 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+#ifdef VM
+  /* One frame descriptor per user page, carved out of the
+     kernel pool. */
+  frame_init (user_pool.base, bitmap_size (user_pool.used_map));
+#endif
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -73,13 +89,34 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
+  size_t page_idx = BITMAP_ERROR;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+      /* Take a page zeroed ahead of time, if there is one. */
+      page_idx = bitmap_scan_and_flip (pool->zeroed_map, 0, 1, true);
+      zeroed = page_idx != BITMAP_ERROR;
+      if (zeroed)
+        {
+          pool->zeroed_cnt--;
+          bitmap_mark (pool->used_map, page_idx);
+        }
+    }
+  if (!zeroed)
+    {
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+      if (page_idx != BITMAP_ERROR)
+        {
+          pool->zeroed_cnt -= bitmap_count (pool->zeroed_map, page_idx,
+                                            page_cnt, true);
+          bitmap_set_multiple (pool->zeroed_map, page_idx, page_cnt, false);
+        }
+    }
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -89,7 +126,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -149,15 +186,56 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes a free page of each pool that is not zeroed yet, up to
+   ZEROED_MAX per pool.  Returns false if there was nothing to do.
+   Called by the idle thread with interrupts off, which must never
+   block. */
+bool
+palloc_zero_idle (void) 
+{
+  bool kernel = zero_free_page (&kernel_pool);
+  bool user = zero_free_page (&user_pool);
+
+  return kernel || user;
+}
+
+/* Zeroes one free page of POOL that is not zeroed yet.  Returns
+   false if there is none, enough are zeroed already, or the pool
+   is busy. */
+static bool
+zero_free_page (struct pool *pool) 
+{
+  size_t idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* With interrupts off nobody else can run, so the pool is
+     consistent unless a thread blocked while holding its lock. */
+  if (pool->lock.holder != NULL || pool->zeroed_cnt >= ZEROED_MAX)
+    return false;
+
+  for (idx = bitmap_scan (pool->used_map, 0, 1, false); idx != BITMAP_ERROR;
+       idx = bitmap_scan (pool->used_map, idx + 1, 1, false))
+    if (!bitmap_test (pool->zeroed_map, idx))
+      {
+        memset (pool->base + PGSIZE * idx, 0, PGSIZE);
+        bitmap_mark (pool->zeroed_map, idx);
+        pool->zeroed_cnt++;
+        return true;
+      }
+  return false;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and zeroed_map at its base.
+     Calculate the space needed for the bitmaps
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (unsigned long));
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -166,7 +244,10 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->zeroed_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                        bm_size);
+  p->zeroed_cnt = 0;
   p->base = base + bm_pages * PGSIZE;
 }
 
@@ -15,22 +15,41 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  One FIFO queue per
+   priority, and a mask with bit PRI_MAX - I set while queue I is
+   not empty.
+
+   With aging, the priority of every ready thread rises by one
+   each tick.  Instead of touching the threads, ready_shift counts
+   the ticks and the queue of priority P is READY_INDEX (P), so
+   that all queues move up a level at once.  A thread's priority
+   is brought up to date when it leaves the run queue. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;
+static unsigned ready_shift;
+
+#define READY_INDEX(PRI) (((PRI) - ready_shift) & PRI_MAX)
+#define READY_BIT(INDEX) ((uint64_t) 1 << (PRI_MAX - (INDEX)))
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
 /*    Project 3   */
-static struct list sleep_list;
+/* Sleeping threads, a skew heap on wakeup_time linked through
+   sleep_left and sleep_right, earliest at the root. */
+static struct thread *sleep_heap;
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -69,6 +88,27 @@ bool thread_prior_aging;
 bool thread_mlfqs;
 real load_avg;
 
+/* MLFQS decay of recent_cpu, applied lazily.  Each second adds an
+   epoch with its own coefficient, 2*load_avg / (2*load_avg + 1).
+   A blocked thread catches up with the epochs it missed only when
+   it is next enqueued or examined, so the timer interrupt walks
+   just the ready threads each second.  That walk stays: a decay
+   changes the priorities of ready threads unequally, depending on
+   their nice values, so the run queues would otherwise pick by
+   stale priorities.  Once every DECAY_HISTORY epochs all threads
+   catch up, so none falls further behind than the coefficients
+   kept; per second that is 1/DECAY_HISTORY of a walk over all
+   threads, against one walk each second without the lazy decay. */
+#define DECAY_HISTORY 64
+static real decay_coef[DECAY_HISTORY];
+static int64_t decay_epoch;
+
+/* Seconds of uptime whose MLFQS update was done, and the same in
+   4-tick periods for the running thread's priority.  Ticks folded
+   in after a tickless idle may step over either boundary. */
+static int64_t mlfqs_second;
+static int64_t mlfqs_period;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -80,6 +120,8 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_remove (struct thread *);
+static void mlfqs_catch_up (void);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -97,12 +139,14 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
-  list_init (&sleep_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -156,14 +200,24 @@ thread_tick (void)
 
   if(thread_mlfqs){
     old_level = intr_disable ();
-    if (timer_ticks() % TIMER_FREQ == 0) {
+    while (mlfqs_second < timer_ticks() / TIMER_FREQ) {
+      real tmp;
+
       load_avg = calc_load_avg();
-      thread_foreach(thread_update_recent_cpu, NULL);
+      tmp = mult_real_int(load_avg, 2);
+      decay_coef[decay_epoch++ % DECAY_HISTORY] = div_real(tmp, add_real_int(tmp, 1));
+      mlfqs_second++;
+      mlfqs_catch_up ();
     }
-    
-    if (timer_ticks() % 4 == 0){
-      thread_foreach(thread_update_priority, NULL);
-      list_sort(&ready_list, reorder_ready_list, NULL);
+
+    /* Only the running thread's priority changes between its
+       enqueues, the others are brought up to date by insert_ready(). */
+    if (mlfqs_period < timer_ticks() / 4) {
+      mlfqs_period = timer_ticks() / 4;
+      if (t != idle_thread) {
+        thread_update_recent_cpu(t, NULL);
+        thread_update_priority(t, NULL);
+      }
     }
     intr_set_level (old_level);
   }
@@ -172,6 +226,9 @@ thread_tick (void)
   if(thread_prior_aging == true)
     thread_aging ();
 #endif
+#ifdef VM
+  frame_load_tick ();
+#endif
 }
 
 /* Prints thread statistics. */
@@ -408,7 +465,13 @@ void
 thread_set_nice (int nice) 
 {
   int prev = thread_current() -> nice;
+  enum intr_level old_level;
+
   thread_current ()->nice = nice;
+  old_level = intr_disable ();
+  thread_update_recent_cpu (thread_current (), NULL);
+  thread_update_priority (thread_current (), NULL);
+  intr_set_level (old_level);
   if(prev < nice) thread_yield();
 }
 
@@ -430,6 +493,10 @@ thread_get_load_avg (void)
 int
 thread_get_recent_cpu (void) 
 {
+  enum intr_level old_level = intr_disable ();
+
+  thread_update_recent_cpu (thread_current (), NULL);
+  intr_set_level (old_level);
   return 100 * thread_current() -> recent_cpu;
 }
 
@@ -455,6 +522,18 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Spend the spare time zeroing free pages for PAL_ZERO
+         requests, one at a time so that interrupts are not held
+         off for long.  Halt once there is nothing left to do. */
+      if (palloc_zero_idle ())
+        {
+          intr_enable ();
+          continue;
+        }
+
+      /* Stop the periodic tick until the next deadline. */
+      timer_idle ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -522,8 +601,10 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
   t->nice = 0;
   t->recent_cpu = 0;
+  t->decay_epoch = decay_epoch;
 #ifdef VM
   t->page_table = NULL;
+  list_init (&t->vm_areas);
 #endif
 
   old_level = intr_disable ();
@@ -555,9 +636,32 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  unsigned shift = ready_shift & PRI_MAX;
+  uint64_t mask = ready_mask;
+  uint32_t half, bit;
+  struct thread *t;
+
+  if (mask == 0)
     return idle_thread;
-  return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  /* Rotated by the aging shift, bit PRI_MAX - P of the mask stands
+     for priority P.  Its lowest set bit is the highest priority. */
+  if (shift != 0)
+    mask = (mask >> shift) | (mask << (PRI_MAX + 1 - shift));
+  half = (uint32_t) mask;
+  if (half != 0)
+    asm ("bsfl %1, %0" : "=r" (bit) : "rm" (half));
+  else
+    {
+      half = mask >> 32;
+      asm ("bsfl %1, %0" : "=r" (bit) : "rm" (half));
+      bit += 32;
+    }
+
+  t = list_entry (list_front (&ready_queues[READY_INDEX (PRI_MAX - bit)]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -622,6 +726,10 @@ schedule (void)
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
+
+  /* Leaving idle: bring back the periodic tick. */
+  if (cur == idle_thread && next != idle_thread)
+    timer_resume ();
   
   if (cur != next)
     prev = switch_threads (cur, next);
@@ -645,6 +753,35 @@ allocate_tid (void)
 /*    Project 3   */
 
 
+/* Melds sleep heaps A and B and returns the root.  Walks down the
+   right spines swapping children on the way, which keeps inserts
+   and removals at O(log n) amortized. */
+static struct thread *
+sleep_meld (struct thread *a, struct thread *b)
+{
+  struct thread *root = NULL, **link = &root;
+
+  while (a != NULL && b != NULL)
+    {
+      struct thread *next;
+
+      if (b->wakeup_time < a->wakeup_time)
+        {
+          next = a;
+          a = b;
+          b = next;
+        }
+      *link = a;
+      next = a->sleep_right;
+      a->sleep_right = a->sleep_left;
+      link = &a->sleep_left;
+      a = next;
+    }
+  *link = a != NULL ? a : b;
+  return root;
+}
+
+/* Blocks the current thread until timer tick WAKEUP_TIME. */
 void thread_sleep (int64_t wakeup_time){
   struct thread *cur = thread_current();
   enum intr_level old_level;
@@ -654,56 +791,79 @@ void thread_sleep (int64_t wakeup_time){
   old_level = intr_disable ();
   if(cur != idle_thread){
     cur->wakeup_time = wakeup_time;
-    list_push_back(&sleep_list, &cur->elem);
+    cur->sleep_left = cur->sleep_right = NULL;
+    sleep_heap = sleep_meld (sleep_heap, cur);
     thread_block();
   }
 
   intr_set_level(old_level);
 }
 
+/* Wakes up the threads whose wakeup_time has come.  Called by
+   the timer interrupt on every tick, it only looks at the root of
+   the sleep heap unless a thread is due. */
 void check_wakeup(int64_t now){
-
-  struct list_elem *e;
-
-  for (e = list_begin (&sleep_list); e != list_end (&sleep_list);)
+  while (sleep_heap != NULL && sleep_heap->wakeup_time <= now)
     {
-      struct thread *t = list_entry (e, struct thread, elem);
-      e = list_next (e);
+      struct thread *t = sleep_heap;
 
-      if(t->wakeup_time <= now ){
-        list_remove(&t->elem);
-        thread_unblock(t);
-      }
+      sleep_heap = sleep_meld (t->sleep_left, t->sleep_right);
+      thread_unblock (t);
     }
-  
-  if(thread_mlfqs) {
-    list_sort(&ready_list, reorder_ready_list, NULL);
-  }
 }
 
+/* Returns the tick at which the next sleeping thread wakes up,
+   or INT64_MAX if none sleeps.  Interrupts must be off. */
+int64_t thread_next_wakeup(void){
+  return sleep_heap != NULL ? sleep_heap->wakeup_time : INT64_MAX;
+}
+
+/* Appends NEW_THREAD to the run queue of its priority, behind
+   the threads of equal priority.  Interrupts must be off. */
 void insert_ready(struct thread *new_thread){
-  struct list_elem *e;
+  int pri;
 
-  for (e = list_begin (&ready_list); e != list_end (&ready_list); e = list_next(e)){
-    struct thread *t = list_entry (e, struct thread, elem);
-    
-    if(t->priority < new_thread->priority){
-      list_insert(e, &new_thread->elem);
-      return;
-    }
+  if (thread_mlfqs) {
+    thread_update_recent_cpu(new_thread, NULL);
+    new_thread->priority = get_mlfq_priority(new_thread);
   }
-  list_insert(e, &new_thread->elem);
+  pri = new_thread->priority;
+  new_thread->aged_from = ready_shift;
+
+  list_push_back(&ready_queues[READY_INDEX(pri)], &new_thread->elem);
+  ready_mask |= READY_BIT(READY_INDEX(pri));
+  ready_cnt++;
 }
 
+/* Takes T off the run queue, bringing its priority up to date
+   with the aging it went through.  Interrupts must be off. */
+static void ready_remove(struct thread *t){
+  unsigned aged = ready_shift - t->aged_from;
+  int pri = aged >= (unsigned) (PRI_MAX - t->priority) ? PRI_MAX : t->priority + (int) aged;
+
+  t->priority = pri;
+  list_remove(&t->elem);
+  if (list_empty(&ready_queues[READY_INDEX(pri)]))
+    ready_mask &= ~READY_BIT(READY_INDEX(pri));
+  ready_cnt--;
+}
+
+/* Raises the priority of every ready thread by one, in constant
+   time: shifting the queues makes each one stand for the next
+   priority up.  The queue at PRI_MAX would wrap around to
+   PRI_MIN, so its threads go in front of the new PRI_MAX queue,
+   ahead of the threads just arriving there. */
 void thread_aging (){
-  struct list_elem *e;
-  
-  for (e = list_begin (&ready_list); e != list_end (&ready_list); e = list_next(e)){
-    struct thread *t = list_entry (e, struct thread, elem);
-    
-    t->priority++;
-    if(PRI_MAX < t->priority) t->priority = PRI_MAX;
-  }
+  int top = READY_INDEX(PRI_MAX), next;
+
+  ready_shift++;
+  next = READY_INDEX(PRI_MAX);
+  if (list_empty(&ready_queues[top]))
+    return;
+  list_splice(list_begin(&ready_queues[next]),
+              list_begin(&ready_queues[top]), list_end(&ready_queues[top]));
+  ready_mask &= ~READY_BIT(top);
+  ready_mask |= READY_BIT(next);
 }
 
 real calc_load_avg(void){
@@ -712,14 +872,6 @@ real calc_load_avg(void){
   return ret;
 }
 
-int calc_recent_cpu(struct thread* t){
-  int recent_cpu = t->recent_cpu;
-  real tmp = mult_real_int(load_avg, 2);
-  tmp = div_real(tmp, add_real_int(tmp, 1));
-  tmp = mult_real_int(tmp, recent_cpu);
-  recent_cpu = to_near_int(add_real_int(tmp, t->nice));
-  return recent_cpu;
-}
 
 int get_mlfq_priority(struct thread* t){
   real pri_max = to_real(PRI_MAX);
@@ -731,23 +883,58 @@ int get_mlfq_priority(struct thread* t){
   return ret;
 }
 
+/* Applies to T's recent_cpu the decays of the epochs since it was
+   last brought up to date.  Interrupts must be off. */
 void thread_update_recent_cpu (struct thread *t, void *aux UNUSED) {
-  t->recent_cpu = calc_recent_cpu(t);
+  int64_t e = t->decay_epoch;
+
+  ASSERT (decay_epoch - e <= DECAY_HISTORY);
+  for (; e < decay_epoch; e++) {
+    real tmp = mult_real_int(decay_coef[e % DECAY_HISTORY], t->recent_cpu);
+    t->recent_cpu = to_near_int(add_real_int(tmp, t->nice));
+  }
+  t->decay_epoch = decay_epoch;
+}
+
+/* Brings the ready threads up to date with the decay epoch just
+   added, moving them to the run queues of their new priorities,
+   and every DECAY_HISTORY epochs all other threads too.  A thread
+   that moves to a queue not visited yet is seen again, to no
+   effect.  Interrupts must be off. */
+static void mlfqs_catch_up (void) {
+  struct list_elem *e, *next;
+  int i;
+
+  if (decay_epoch % DECAY_HISTORY == 0)
+    thread_foreach (thread_update_recent_cpu, NULL);
+  for (i = 0; i <= PRI_MAX; i++)
+    for (e = list_begin (&ready_queues[i]); e != list_end (&ready_queues[i]); e = next) {
+      struct thread *t = list_entry (e, struct thread, elem);
+
+      next = list_next (e);
+      thread_update_recent_cpu (t, NULL);
+      thread_update_priority (t, NULL);
+    }
 }
 
+/* Recomputes the MLFQS priority of T, moving it to its new run
+   queue if it is ready.  Interrupts must be off. */
 void thread_update_priority (struct thread *t, void *aux UNUSED) {
-  t->priority = get_mlfq_priority(t);
+  int pri = get_mlfq_priority(t);
+
+  if (pri == t->priority)
+    return;
+  if (t->status == THREAD_READY && t != idle_thread) {
+    ready_remove(t);
+    t->priority = pri;
+    insert_ready(t);
+  } else {
+    t->priority = pri;
+  }
 }
 
 int get_ready_threads(void){
-  return list_size(&ready_list) + (thread_current() != idle_thread);
-}
-
-bool reorder_ready_list (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  struct thread* t1, *t2;
-  t1 = list_entry (a, struct thread, elem);
-  t2 = list_entry (b, struct thread, elem);
-  return t1->priority > t2->priority;
+  return ready_cnt + (thread_current() != idle_thread);
 }
 
 int get_priority(void){
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include <hash.h>
+#include <vmstat.h>
 #include "synch.h"
 #include "devices/timer.h"
 #include "vm/page.h"
@@ -135,6 +136,8 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    int tlb_defer;                      /* Nesting of pagedir_defer_begin(). */
+    bool tlb_stale;                     /* TLB flush owed by pagedir_defer_end(). */
 #endif
 
     /* Owned by thread.c. */
@@ -150,13 +153,25 @@ struct thread
 
    /*    Project 3   */
    int64_t wakeup_time;
+   struct thread *sleep_left;           /* Children in the sleep heap. */
+   struct thread *sleep_right;
    int nice;
    int recent_cpu;
+   int64_t decay_epoch;                 /* Decays applied to recent_cpu, see thread.c. */
+   unsigned aged_from;                  /* Aging ticks when put on the run queue. */
 
    /*    Project 4   */
 #ifdef VM
-   struct hash* page_table;
+   struct hash* page_table;             /* Pages faulted in at least once. */
+   struct list vm_areas;                /* Address space layout, see vm/page.h. */
    struct file* exec_file;
+   uint8_t *fault_next;                 /* Page right after the last fault-around window. */
+   size_t fault_around;                 /* Pages to populate around the next file fault. */
+   void *user_esp;                      /* User stack pointer at syscall entry. */
+   struct vmstat vmstat;                /* Paging statistics, see vm/page.h. */
+   long long fault_mark;                /* Major faults at the last load check. */
+   int64_t suspended;                   /* Tick held back by load control, or 0. */
+   bool parked;                         /* Blocked until load control resumes it. */
 #endif
 
   };
@@ -201,16 +216,15 @@ int thread_get_load_avg (void);
 /*    Project 3   */
 void thread_sleep (int64_t wakeup_time);
 void check_wakeup(int64_t now);
+int64_t thread_next_wakeup(void);
 void insert_ready(struct thread * new_thread);
 void thread_aging(void);
 
 real calc_load_avg(void);
-int calc_recent_cpu(struct thread* t);
 int get_mlfq_priority(struct thread* t);
 int get_ready_threads(void);
 int get_priority(void);
 thread_action_func thread_update_recent_cpu;
 thread_action_func thread_update_priority;
-list_less_func reorder_ready_list;
 
 #endif /* threads/thread.h */
@@ -6,6 +6,7 @@
 #include "threads/thread.h"
 #include "userprog/syscall.h"
 #include "threads/vaddr.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 
 #define MAX_STK_SIZE 8388608
@@ -13,8 +14,25 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Exception table: kernel instructions that may fault on user
+   memory, each with the address to resume at instead.  Entries
+   are emitted next to the instructions by EX_TABLE_ENTRY and
+   gathered between the linker symbols below. */
+struct ex_table_entry
+  {
+    uintptr_t insn;             /* Instruction that may fault. */
+    uintptr_t fixup;            /* Where to continue if it does. */
+  };
+extern const struct ex_table_entry _start_ex_table[], _end_ex_table[];
+
+#define EX_TABLE_ENTRY(INSN, FIXUP)                     \
+        ".pushsection __ex_table, \"a\"\n"              \
+        ".long " INSN ", " FIXUP "\n"                    \
+        ".popsection\n"
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static bool fixup_exception (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -72,6 +90,67 @@ exception_print_stats (void)
   printf ("Exception: %lld page faults\n", page_fault_cnt);
 }
 
+/* Returns true if the SIZE bytes at UADDR are all user
+   addresses. */
+static bool
+is_user_range (const void *uaddr, size_t size)
+{
+  const uint8_t *start = uaddr;
+
+  return size == 0
+         || (is_user_vaddr (start) && is_user_vaddr (start + size - 1)
+             && start <= start + size - 1);
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Unmapped
+   pages are faulted in as a user access would.  Returns the
+   number of bytes that could not be copied, so 0 on success. */
+size_t
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  if (!is_user_range (usrc, size))
+    return size;
+
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                EX_TABLE_ENTRY ("1b", "2b")
+                : "+c" (size), "+S" (usrc), "+D" (dst) : : "memory");
+  return size;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns the
+   number of bytes that could not be copied, so 0 on success. */
+size_t
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  if (!is_user_range (udst, size))
+    return size;
+
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                EX_TABLE_ENTRY ("1b", "2b")
+                : "+c" (size), "+S" (src), "+D" (udst) : : "memory");
+  return size;
+}
+
+/* If F is a kernel fault at an instruction of the exception
+   table, resumes F at its fixup address and returns true. */
+static bool
+fixup_exception (struct intr_frame *f)
+{
+  const struct ex_table_entry *e;
+
+  if (f->cs != SEL_KCSEG)
+    return false;
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == (uintptr_t) f->eip)
+      {
+        f->eip = (void (*) (void)) e->fixup;
+        return true;
+      }
+  return false;
+}
+
 /* Handler for an exception (probably) caused by a user process. */
 static void
 kill (struct intr_frame *f) 
@@ -156,32 +235,46 @@ page_fault (struct intr_frame *f)
 
 #ifndef VM
    if(!user || is_kernel_vaddr(fault_addr) || not_present){
-      f->eip = (void (*)(void))f->eax;
-      f->eax = 0xffffffff;
-      sys_exit(-1);
+      // Faulting copy_from_user() and the like give up quietly
+      if (fixup_exception (f)) return;
+      // Any other kernel fault is a bug, kill() panics below
+      if (user) {
+         f->eip = (void (*)(void))f->eax;
+         f->eax = 0xffffffff;
+         sys_exit(-1);
+      }
    }
 #else
+   // Load control may be holding this process back
+   if (user)
+      frame_throttle ();
+
    // Page fault didn't occur by write to read-only file
    if (not_present) {
-      // paging으로 해결
-      if(user && page_fault_handler(fault_addr, write)) return;
+      // paging으로 해결, also for user memory touched by syscalls
+      if(is_user_vaddr(fault_addr) && page_fault_handler(fault_addr, write)) return;
       // Stack growth
+      void *esp = user ? f->esp : thread_current()->user_esp;
       if( fault_addr < PHYS_BASE 
          && PHYS_BASE - MAX_STK_SIZE <= fault_addr
-         && f -> esp <= fault_addr + 32
-         && PHYS_BASE - MAX_STK_SIZE <= f->esp - PGSIZE ){
-
-         page_create_and_insert_entry (thread_current() -> page_table, 
-            NULL, 0, pg_round_down(fault_addr), 0, 0, 0);
-         page_fault_handler (fault_addr, true);
-
+         && esp <= fault_addr + 32
+         && PHYS_BASE - MAX_STK_SIZE <= esp - PGSIZE
+         && page_grow_stack (fault_addr)
+         && page_fault_handler (fault_addr, true))
          return;
-      }
 
+   } else if (write && is_user_vaddr(fault_addr)) {
+      // Write to a page shared copy-on-write, also from syscalls
+      if (page_cow_handler(fault_addr)) return;
+   }
+   // Faulting copy_from_user() and the like give up quietly
+   if (fixup_exception (f)) return;
+   // Any other kernel fault is a bug, kill() panics below
+   if (user) {
+      f->eip = (void (*)(void))f->eax;
+      f->eax = 0xffffffff;
+      sys_exit(-1);
    }
-   f->eip = (void (*)(void))f->eax;
-   f->eax = 0xffffffff;
-   sys_exit(-1);
 #endif
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
@@ -1,6 +1,8 @@
 #ifndef USERPROG_EXCEPTION_H
 #define USERPROG_EXCEPTION_H
 
+#include <stddef.h>
+
 /* Page fault error code bits that describe the cause of the exception.  */
 #define PF_P 0x1    /* 0: not-present page. 1: access rights violation. */
 #define PF_W 0x2    /* 0: read, 1: write. */
@@ -9,4 +11,7 @@
 void exception_init (void);
 void exception_print_stats (void);
 
+size_t copy_from_user (void *dst, const void *usrc, size_t size);
+size_t copy_to_user (void *udst, const void *src, size_t size);
+
 #endif /* userprog/exception.h */
@@ -5,10 +5,12 @@
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
 #include "vm/frame.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+static void flush_tlb (void);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -154,7 +156,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -182,7 +184,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -211,7 +213,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -245,21 +247,66 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Defers TLB invalidations by the current thread until the
+   matching pagedir_defer_end(), which then flushes the TLB once
+   if anything was invalidated in between.  Meant for sweeps that
+   clear many entries.  Calls nest.  The caller must not access the
+   affected user pages in between; a process switch flushes user
+   entries anyway. */
+void
+pagedir_defer_begin (void)
+{
+  thread_current ()->tlb_defer++;
+}
+
+/* Ends a batch started by pagedir_defer_begin(). */
+void
+pagedir_defer_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->tlb_defer > 0);
+  if (--t->tlb_defer == 0 && t->tlb_stale)
+    {
+      t->tlb_stale = false;
+      flush_tlb ();
+    }
+}
+
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry of the page.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VADDR if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Within a pagedir_defer_begin() batch it only notes
+   that a flush is due. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vaddr)
 {
-  if (active_pd () == pd) 
+  if (active_pd () == pd)
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+      struct thread *t = thread_current ();
+
+      if (t->tlb_defer > 0)
+        t->tlb_stale = true;
+      else
+        {
+          /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+          asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+        }
+    }
+}
+
+/* Flushes all non-global TLB entries by reloading CR3, which
+   keeps the kernel's global mappings.  See [IA32-v3a] 3.12
+   "Translation Lookaside Buffers (TLBs)". */
+static void
+flush_tlb (void)
+{
+  uintptr_t cr3;
+
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
 }
@@ -26,6 +26,9 @@
 
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
+#ifdef VM
+static thread_func fork_process NO_RETURN;
+#endif
 
 /*          PROJECT 1          */
 static int parse_file_name(char *file_name, char **argv);
@@ -109,6 +112,93 @@ static void start_process(void *file_name_) {
   NOT_REACHED();
 }
 
+#ifdef VM
+/* What fork_process() needs from the forking process. */
+struct fork_args {
+  struct thread *parent;
+  struct intr_frame *if_;       /* Parent's user context at the syscall. */
+};
+
+/* Creates a child of the current process that resumes from the
+   system call frame F with the same address space, shared
+   copy-on-write, and the same open files.  Returns the child's
+   thread id in the parent, or -1 if the copy failed. */
+tid_t process_fork(struct intr_frame *f) {
+  struct thread *cur = thread_current();
+  struct fork_args args = { cur, f };
+  struct child *ch;
+  tid_t tid;
+
+  tid = thread_create(cur->name, PRI_DEFAULT, fork_process, &args);
+  if (tid == TID_ERROR) return -1;
+
+  ch = find_child(tid, &cur->child_list);
+  sema_down(&ch->load_sema);
+  if (!ch->load_result) {
+    /* The child exits on its own, reap it. */
+    sema_down(&ch->wait_sema);
+    list_remove(&ch->elem);
+    free(ch);
+    return -1;
+  }
+
+  return tid;
+}
+
+/* A thread function that copies the forking process and returns
+   to user mode with 0 as the result of fork(). */
+static void fork_process(void *args_) {
+  struct fork_args *args = args_;
+  struct thread *t = thread_current();
+  struct thread *parent = args->parent;
+  struct intr_frame if_ = *args->if_;
+  bool success = false;
+  int fd;
+
+  t->pagedir = pagedir_create();
+  if (t->pagedir == NULL) goto done;
+  process_activate();
+  page_init_table(&t->page_table);
+
+  /* Our areas and pages are backed by our own exec_file. */
+  if (parent->exec_file) {
+    lock_acquire(&filesys_lock);
+    t->exec_file = file_reopen(parent->exec_file);
+    if (t->exec_file) file_deny_write(t->exec_file);
+    lock_release(&filesys_lock);
+    if (t->exec_file == NULL) goto done;
+  }
+  /* Not under filesys_lock: writing back dirty mappings takes it. */
+  if (!page_fork(parent)) goto done;
+
+  lock_acquire(&filesys_lock);
+  for (fd = 0; fd < 128; fd++) {
+    if (parent->file_descriptor[fd] == NULL) continue;
+    t->file_descriptor[fd] = file_reopen(parent->file_descriptor[fd]);
+    if (t->file_descriptor[fd] == NULL) break;
+    file_seek(t->file_descriptor[fd], file_tell(parent->file_descriptor[fd]));
+  }
+  lock_release(&filesys_lock);
+  success = fd == 128;
+
+done:
+  t->ch->load_result = success;
+  sema_up(&t->ch->load_sema);
+  if (!success) {
+    /* sys_exit() is not on this path, close what it would. */
+    lock_acquire(&filesys_lock);
+    for (fd = 0; fd < 128; fd++)
+      if (t->file_descriptor[fd]) file_close(t->file_descriptor[fd]);
+    lock_release(&filesys_lock);
+    thread_exit();
+  }
+
+  if_.eax = 0;
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -138,6 +228,17 @@ void process_exit() {
   struct thread *cur = thread_current();
   uint32_t *pd;
 
+#ifdef VM
+  /* Give frames and swap slots back while the page directory
+     they are mapped in still exists. */
+  if (cur->page_table != NULL) {
+    hash_destroy(cur->page_table, page_free_entry);
+    free(cur->page_table);
+    cur->page_table = NULL;
+  }
+  vma_destroy(&cur->vm_areas);
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -155,8 +256,6 @@ void process_exit() {
   }
 #ifdef VM
   if(cur->exec_file) file_close(cur->exec_file);
-  hash_destroy(cur->page_table, page_free_entry);
-  free(cur->page_table);
 #endif
 
   struct child *ch = find_child(cur->tid, &cur->parent->child_list);
@@ -269,8 +368,6 @@ bool load(const char *file_name, void (**eip)(void), void **esp) {
 
 #ifdef VM
   page_init_table(&t->page_table);
-  // if( t->parent && t->parent->page_table )
-    // page_copy_table(t->parent->page_table, t->page_table);
 #endif  
 
   /*          PROJECT 1          */
@@ -430,9 +527,12 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(ofs % PGSIZE == 0);
 
-  #ifndef VM
+  #ifdef VM
+  /* Pages are read on demand, see page_fault_handler(). */
+  return vma_create (&thread_current()->vm_areas, upage,
+    read_bytes + zero_bytes, file, ofs, read_bytes, !writable) != NULL;
+  #else
   file_seek(file, ofs);
-  #endif
 
   while (read_bytes > 0 || zero_bytes > 0) {
     /* Calculate how to fill this page.
@@ -441,10 +541,6 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
     size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
     size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-    #ifdef VM
-    page_create_and_insert_entry (thread_current()->page_table, file,
-      ofs, upage, page_read_bytes, page_zero_bytes, !writable);
-    #else
     /* Get a page of memory. */
     uint8_t *kpage = palloc_get_page(PAL_USER);
 
@@ -462,7 +558,6 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
       palloc_free_page (kpage);
       return false;
     }
-    #endif
 
     /* Advance. */
     read_bytes -= page_read_bytes;
@@ -471,6 +566,7 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
     ofs += page_read_bytes;
   }
   return true;
+  #endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -481,11 +577,14 @@ static bool setup_stack(void **esp) {
 #ifdef VM
   struct page_table_entry* pte;
   struct frame_entry* f;
+  if (!vma_create (&thread_current()->vm_areas, ((uint8_t *)PHYS_BASE) - PGSIZE,
+                   PGSIZE, NULL, 0, 0, false))
+    return false;
   pte = page_create_and_insert_entry (thread_current()->page_table, NULL,
-    0, ((uint8_t *)PHYS_BASE) - PGSIZE, 0, 0, 0);
-  f = frame_get_page(PAL_USER | PAL_ZERO);
-  f->pte = pte;
-  kpage = f->page_ptr;
+    0, ((uint8_t *)PHYS_BASE) - PGSIZE, 0, PGSIZE, 0);
+  if (pte == NULL) return false;
+  f = frame_get_page(PAL_USER | PAL_ZERO, pte);
+  kpage = f != NULL ? f->page_ptr : NULL;
   pte->kpage = kpage;
 #else
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
@@ -493,10 +592,19 @@ static bool setup_stack(void **esp) {
 
   if (kpage != NULL) {
     success = install_page(((uint8_t *)PHYS_BASE) - PGSIZE, kpage, true);
-    if (success)
+    if (success) {
       *esp = PHYS_BASE;
-    else
+#ifdef VM
+      frame_unpin(f);
+#endif
+    } else {
+#ifdef VM
+      pte->kpage = NULL;
+      frame_free_page(kpage);
+#else
       palloc_free_page(kpage);
+#endif
+    }
   }
   return success;
 }
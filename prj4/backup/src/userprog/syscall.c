@@ -12,21 +12,87 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/exception.h"
 #include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 struct lock filesys_lock;
 
 static void syscall_handler(struct intr_frame *);
-static int check_addr_validity(const void *uaddr);
+static void get_args(const void *esp, int *args, int cnt);
+static bool check_user_string(const char *ustr);
+static void check_user_buffer(const void *ubuf, unsigned size, bool write);
+static void pin_user_buffer(const void *ubuf, unsigned size, bool write);
+static void unpin_user_buffer(const void *ubuf, unsigned size);
 int sys_wait(int tid);
 void sys_exit(int status);
 tid_t sys_exec(const char *fname);
 
-static int check_addr_validity(const void *uaddr) {
-  if (!uaddr) return -1;
-  if (!is_user_vaddr(uaddr)) return -1;
-  if (!pagedir_get_page(thread_current()->pagedir, uaddr)) return -1;
-  return 0;
+/* Copies the CNT argument words following the system call number
+   at ESP into ARGS.  Kills the process if they are not readable. */
+static void get_args(const void *esp, int *args, int cnt) {
+  if (copy_from_user(args, (const int *)esp + 1, cnt * sizeof *args) != 0)
+    sys_exit(-1);
+}
+
+/* Returns true if the whole NUL-terminated string at USTR is
+   readable. */
+static bool check_user_string(const char *ustr) {
+  char c;
+
+  do {
+    if (copy_from_user(&c, ustr++, 1) != 0) return false;
+  } while (c != '\0');
+  return true;
+}
+
+/* Kills the process unless all SIZE bytes at UBUF are readable,
+   and writable if WRITE.  One byte per page is read, which also
+   faults the pages in before any lock is taken.  With VM, writes
+   are left to pin_user_buffer(), which breaks copy-on-write only
+   for buffers actually written; a probing write here would dirty
+   every page checked. */
+static void check_user_buffer(const void *ubuf, unsigned size,
+                              bool write UNUSED) {
+  const uint8_t *p = ubuf, *end = p + size;
+  uint8_t c;
+
+  if (size == 0) return;
+  if (end < p) sys_exit(-1);
+  for (; p < end; p = (const uint8_t *)pg_round_down(p) + PGSIZE) {
+    if (copy_from_user(&c, p, 1) != 0) sys_exit(-1);
+#ifndef VM
+    if (write && copy_to_user((void *)p, &c, 1) != 0) sys_exit(-1);
+#endif
+  }
+  if (copy_from_user(&c, end - 1, 1) != 0) sys_exit(-1);
+}
+
+/* Keeps the SIZE bytes at UBUF resident while the file system
+   works on them, so it never faults on them with filesys_lock
+   held.  Kills the process if they are not accessible. */
+static void pin_user_buffer(const void *ubuf UNUSED, unsigned size UNUSED,
+                            bool write UNUSED) {
+#ifdef VM
+  const uint8_t *p = ubuf, *end = p + size;
+
+  for (; p < end; p = (const uint8_t *)pg_round_down(p) + PGSIZE)
+    if (!page_pin(p, write)) {
+      unpin_user_buffer(ubuf, p - (const uint8_t *)ubuf);
+      sys_exit(-1);
+    }
+#endif
+}
+
+static void unpin_user_buffer(const void *ubuf UNUSED, unsigned size UNUSED) {
+#ifdef VM
+  const uint8_t *p = ubuf, *end = p + size;
+
+  for (; p < end; p = (const uint8_t *)pg_round_down(p) + PGSIZE)
+    page_unpin(p);
+#endif
 }
 
 void syscall_init(void) {
@@ -37,19 +103,16 @@ void syscall_init(void) {
 static void syscall_handler(struct intr_frame *f) {
   void *esp = f->esp;
   int syscall_num;
+  int args[4];
 
-  if (check_addr_validity(esp) == -1) sys_exit(-1);
-  syscall_num = *(int *)esp;
+#ifdef VM
+  thread_current()->user_esp = esp;
+#endif
+  if (copy_from_user(&syscall_num, esp, sizeof syscall_num) != 0) sys_exit(-1);
 
   if (syscall_num == SYS_WRITE) {
-    int fd, size, buffer;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    fd = *(int *)(esp + 4);
-    if (check_addr_validity(esp + 8) == -1) sys_exit(-1);
-    buffer = *(int *)(esp + 8);
-    if (check_addr_validity(esp + 12) == -1) sys_exit(-1);
-    size = *(int *)(esp + 12);
+    get_args(esp, args, 3);
+    int fd = args[0], buffer = args[1], size = args[2];
 
     if (fd < 0 || 128 < fd) {
       f->eax = -1;
@@ -59,14 +122,8 @@ static void syscall_handler(struct intr_frame *f) {
     f->eax = sys_write(fd, (void *)buffer, (unsigned)size);
 
   } else if (syscall_num == SYS_READ) {
-    int fd, size, buffer;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    fd = *(int *)(esp + 4);
-    if (check_addr_validity(esp + 8) == -1) sys_exit(-1);
-    buffer = *(int *)(esp + 8);
-    if (check_addr_validity(esp + 12) == -1) sys_exit(-1);
-    size = *(int *)(esp + 12);
+    get_args(esp, args, 3);
+    int fd = args[0], buffer = args[1], size = args[2];
 
     if (fd < 0 || 128 < fd) {
       f->eax = -1;
@@ -76,100 +133,72 @@ static void syscall_handler(struct intr_frame *f) {
     f->eax = sys_read(fd, (void *)buffer, (unsigned)size);
 
   } else if (syscall_num == SYS_EXEC) {
-    char *fname;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    fname = *(char **)(esp + 4);
-    f->eax = sys_exec((const char *)fname);
+    get_args(esp, args, 1);
+    f->eax = sys_exec((const char *)args[0]);
 
   } else if (syscall_num == SYS_EXIT) {
-    int status;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    status = *(int *)(esp + 4);
-
-    sys_exit(status);
+    get_args(esp, args, 1);
+    sys_exit(args[0]);
 
   } else if (syscall_num == SYS_WAIT) {
-    int tid;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    tid = *(int *)(esp + 4);
-
-    f->eax = sys_wait(tid);
+    get_args(esp, args, 1);
+    f->eax = sys_wait(args[0]);
   } else if (syscall_num == SYS_HALT) {
     shutdown_power_off();
   } else if (syscall_num == SYS_FIBO) {
-    int n;
-
-    check_addr_validity(esp + 4);
-    n = *(int *)(esp + 4);
-
-    f->eax = sys_fibonacci(n);
+    get_args(esp, args, 1);
+    f->eax = sys_fibonacci(args[0]);
   } else if (syscall_num == SYS_MAX_FOUR) {
-    int a, b, c, d;
-
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    a = *(int *)(esp + 4);
-    if (check_addr_validity(esp + 8) == -1) sys_exit(-1);
-    b = *(int *)(esp + 8);
-    if (check_addr_validity(esp + 12) == -1) sys_exit(-1);
-    c = *(int *)(esp + 12);
-    if (check_addr_validity(esp + 16) == -1) sys_exit(-1);
-    d = *(int *)(esp + 16);
-
-    f->eax = sys_max_of_four_int(a, b, c, d);
+    get_args(esp, args, 4);
+    f->eax = sys_max_of_four_int(args[0], args[1], args[2], args[3]);
   } else if (syscall_num == SYS_CREATE) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    const char *file = *(const char **)(esp + 4);
-    if (check_addr_validity(esp + 8) == -1) sys_exit(-1);
-    unsigned initial_size = *(unsigned *)(esp + 8);
-
-    f->eax = sys_create(file, initial_size);
+    get_args(esp, args, 2);
+    f->eax = sys_create((const char *)args[0], (unsigned)args[1]);
   } else if (syscall_num == SYS_REMOVE) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    const char *file = *(const char **)(esp + 4);
-
-    f->eax = sys_remove(file);
+    get_args(esp, args, 1);
+    f->eax = sys_remove((const char *)args[0]);
   } else if (syscall_num == SYS_OPEN) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    const char *file = *(const char **)(esp + 4);
-
-    f->eax = sys_open(file);
+    get_args(esp, args, 1);
+    f->eax = sys_open((const char *)args[0]);
   } else if (syscall_num == SYS_CLOSE) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    int fd = *(int *)(esp + 4);
-
-    sys_close(fd);
+    get_args(esp, args, 1);
+    sys_close(args[0]);
   } else if (syscall_num == SYS_FILESIZE) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    int fd = *(int *)(esp + 4);
-
-    f->eax = sys_filesize(fd);
+    get_args(esp, args, 1);
+    f->eax = sys_filesize(args[0]);
   } else if (syscall_num == SYS_SEEK) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    int fd = *(int *)(esp + 4);
-    if (check_addr_validity(esp + 8) == -1) sys_exit(-1);
-    unsigned position = *(unsigned *)(esp + 8);
-
-    sys_seek(fd, position);
+    get_args(esp, args, 2);
+    sys_seek(args[0], (unsigned)args[1]);
   } else if (syscall_num == SYS_TELL) {
-    if (check_addr_validity(esp + 4) == -1) sys_exit(-1);
-    int fd = *(int *)(esp + 4);
-
-    f->eax = sys_tell(fd);
+    get_args(esp, args, 1);
+    f->eax = sys_tell(args[0]);
+  }
+#ifdef VM
+  else if (syscall_num == SYS_MMAP) {
+    get_args(esp, args, 2);
+    f->eax = sys_mmap(args[0], (void *)args[1]);
+  } else if (syscall_num == SYS_MUNMAP) {
+    get_args(esp, args, 1);
+    sys_munmap(args[0]);
+  } else if (syscall_num == SYS_FORK) {
+    f->eax = sys_fork(f);
+  } else if (syscall_num == SYS_VMSTAT) {
+    get_args(esp, args, 2);
+    sys_vmstat((struct vmstat *)args[0], (struct vmstat *)args[1]);
   }
+#endif
 }
 
 int sys_write(int fd, const char *buffer, unsigned size) {
-  if (check_addr_validity(buffer) == -1)
-    sys_exit(-1);
+  check_user_buffer(buffer, size, false);
 
   if (fd == 1) {
     // STDOUT
+    pin_user_buffer(buffer, size, false);
     lock_acquire(&filesys_lock);
     putbuf(buffer, size);
     lock_release(&filesys_lock);
+    unpin_user_buffer(buffer, size);
     return size;
   } else {
     struct thread *th = thread_current();
@@ -181,25 +210,24 @@ int sys_write(int fd, const char *buffer, unsigned size) {
     if (!(f = th->file_descriptor[fd])) {
       return -1;
     }
+    pin_user_buffer(buffer, size, false);
     lock_acquire(&filesys_lock);
 
     int t = file_write(f, (const void *)buffer, size);
     lock_release(&filesys_lock);
+    unpin_user_buffer(buffer, size);
     return t;
   }
 }
 
 int sys_read(int fd, char *buffer, unsigned length) {
-  if (check_addr_validity(buffer) == -1) sys_exit(-1);
-  //pagedir에 새로운 페이지가 없어서 buffer + length에서 page fault가 일어난다. 
-  if (check_addr_validity(buffer + length) == -1) {
-    sys_exit(-1);
-  }
+  check_user_buffer(buffer, length, true);
 
   if (fd == 0) {
     // STDIN
     unsigned cnt = 0;
     uint8_t c;
+    pin_user_buffer(buffer, length, true);
     lock_acquire(&filesys_lock);
     for (cnt = 0; cnt < length; cnt++) {
       c = input_getc();
@@ -207,6 +235,7 @@ int sys_read(int fd, char *buffer, unsigned length) {
       if (!c) break;
     }
     lock_release(&filesys_lock);
+    unpin_user_buffer(buffer, length);
     return length - cnt;
   } else {
     struct thread *th = thread_current();
@@ -216,9 +245,11 @@ int sys_read(int fd, char *buffer, unsigned length) {
     if (!(f = th->file_descriptor[fd])) {
       return -1;
     }
+    pin_user_buffer(buffer, length, true);
     lock_acquire(&filesys_lock);
     ret = file_read(f, (void *)buffer, length);
     lock_release(&filesys_lock);
+    unpin_user_buffer(buffer, length);
     return ret;
   }
 
@@ -241,7 +272,7 @@ void sys_exit(int status) {
 }
 
 tid_t sys_exec(const char *fname) {
-  if (check_addr_validity(fname) == -1) return -1;
+  if (!check_user_string(fname)) return -1;
 
   return process_execute(fname);
 }
@@ -274,24 +305,30 @@ int sys_max_of_four_int(int a, int b, int c, int d) {
 }
 
 int sys_create(const char *file, unsigned initial_size) {
-  if (check_addr_validity(file) == -1) sys_exit(-1);
+  if (!check_user_string(file)) sys_exit(-1);
   if (!strlen(file)) return 0;
+  pin_user_buffer(file, strlen(file) + 1, false);
   lock_acquire(&filesys_lock);
   int ret = filesys_create(file, initial_size);
   lock_release(&filesys_lock);
+  unpin_user_buffer(file, strlen(file) + 1);
   return ret;
 }
 
 int sys_remove(const char *file) {
-  if (check_addr_validity(file) == -1) return 0;
+  if (!check_user_string(file)) return 0;
+  pin_user_buffer(file, strlen(file) + 1, false);
   lock_acquire(&filesys_lock);
   int ret = filesys_remove(file);
   lock_release(&filesys_lock);
+  unpin_user_buffer(file, strlen(file) + 1);
   return ret;
 }
 
 int sys_open(const char *file) {
   if (!file) return -1;
+  if (!check_user_string(file)) sys_exit(-1);
+  pin_user_buffer(file, strlen(file) + 1, false);
   lock_acquire(&filesys_lock);
 
   int fd;
@@ -302,6 +339,7 @@ int sys_open(const char *file) {
     ;
   if (fd == 128 || !(f = filesys_open(file))) {
     lock_release(&filesys_lock);
+    unpin_user_buffer(file, strlen(file) + 1);
     return -1;
   }
 
@@ -309,6 +347,7 @@ int sys_open(const char *file) {
 
   th->file_descriptor[fd] = f;
   lock_release(&filesys_lock);
+  unpin_user_buffer(file, strlen(file) + 1);
   return fd;
 }
 
@@ -353,4 +392,34 @@ void sys_close(int fd) {
   th->file_descriptor[fd] = NULL;
 
   lock_release(&filesys_lock);
-}
\ No newline at end of file
+}
+
+#ifdef VM
+int sys_fork(struct intr_frame *f) {
+  return process_fork(f);
+}
+
+void sys_vmstat(struct vmstat *self, struct vmstat *total) {
+  struct vmstat s, t;
+
+  page_get_stats(&s, &t);
+  if (self && copy_to_user(self, &s, sizeof s) != 0) sys_exit(-1);
+  if (total && copy_to_user(total, &t, sizeof t) != 0) sys_exit(-1);
+}
+
+int sys_mmap(int fd, void *addr) {
+  struct thread *th = thread_current();
+  struct file *f;
+  int mapid;
+
+  if (fd < 2 || 127 < fd) return -1;
+  if (!(f = th->file_descriptor[fd])) return -1;
+
+  lock_acquire(&filesys_lock);
+  mapid = page_mmap(f, addr);
+  lock_release(&filesys_lock);
+  return mapid;
+}
+
+void sys_munmap(int mapid) { page_munmap(mapid); }
+#endif
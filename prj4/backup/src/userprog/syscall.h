@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/synch.h"
+
+/* Serializes all file system access. */
+extern struct lock filesys_lock;
+
 void syscall_init (void);
 void sys_exit(int status);
 
@@ -19,4 +24,14 @@ int sys_write (int fd, const char *buffer, unsigned length);
 void sys_seek (int fd, unsigned position);
 unsigned sys_tell (int fd);
 
+/* Project 4 */
+#ifdef VM
+struct intr_frame;
+struct vmstat;
+int sys_fork (struct intr_frame *f);
+void sys_vmstat (struct vmstat *self, struct vmstat *total);
+int sys_mmap (int fd, void *addr);
+void sys_munmap (int mapid);
+#endif
+
 #endif /* userprog/syscall.h */
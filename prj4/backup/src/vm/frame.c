@@ -1,93 +1,822 @@
-#include "threads/malloc.h"
 #include "threads/thread.h"
 #include "frame.h"
+#include <hash.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/page.h"
 #include "swap.h"
 
-void frame_init(){
+/* Frame table: a contiguous array with one entry per user pool
+   page, allocated once from the kernel pool by palloc_init(). */
+static struct frame_entry *frame_table;
+static size_t frame_cnt;
+static uint8_t *frame_base;             /* First page of the user pool. */
+static struct lock frame_table_lock;
+static struct condition frame_evicted;  /* Signaled after each eviction. */
+
+/* Index of the next frame the clock hand examines. */
+static size_t clock_hand;
+
+/* Most frames reclaimed by a single eviction. */
+#define EVICT_BATCH 8
+
+/* Number of frames currently handed out. */
+static size_t frame_used;
+
+size_t frame_low_watermark = FRAME_WATERMARK_DEFAULT;
+size_t frame_high_watermark = FRAME_WATERMARK_DEFAULT;
+
+/* Page cleaner thread state. */
+static struct semaphore cleaner_wakeup;
+static bool cleaner_awake;
+
+static thread_func frame_cleaner NO_RETURN;
+
+/* Load control, checked every LOAD_INTERVAL ticks.  Its state is
+   only touched with interrupts off. */
+#define LOAD_INTERVAL (TIMER_FREQ / 2)
+unsigned frame_thrash_rate = FRAME_THRASH_DEFAULT;
+static long long load_mark;             /* Major faults at the last check. */
+static int64_t load_interval;           /* Interval of the last check. */
+
+/* Share cache: read-only file pages resident in some frame, keyed
+   by (inode, offset), so processes running the same executable map
+   the same frames.  A fixed array of buckets, one per frame. */
+static struct list *share_buckets;
+static size_t share_bucket_cnt;
+
+static struct frame_entry* frame_alloc(enum palloc_flags flag, struct page_table_entry *pte, bool may_evict);
+static struct frame_entry* frame_take(enum palloc_flags flag, bool may_evict);
+static struct frame_entry* frame_evict(void);
+static void frame_remove(struct frame_entry *f);
+static void frame_unshare(struct frame_entry *f);
+static void frame_wait(struct page_table_entry *pte);
+
+/* Sets up the frame table for the USER_PAGES pages of the user
+   pool starting at USER_BASE. */
+void frame_init(void *user_base, size_t user_pages){
+    size_t table_pages = DIV_ROUND_UP(user_pages * sizeof *frame_table, PGSIZE);
+
     lock_init(&frame_table_lock);
-    hash_init(&frame_table, frame_hash, frame_less, NULL);
+    cond_init(&frame_evicted);
+    frame_base = user_base;
+    frame_cnt = user_pages;
+    frame_table = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, table_pages);
+    for (size_t i = 0; i < frame_cnt; i++) {
+        frame_table[i].page_ptr = frame_base + i * PGSIZE;
+        list_init(&frame_table[i].ptes);
+    }
+    clock_hand = 0;
+
+    share_bucket_cnt = frame_cnt > 0 ? frame_cnt : 1;
+    share_buckets = palloc_get_multiple(PAL_ASSERT,
+        DIV_ROUND_UP(share_bucket_cnt * sizeof *share_buckets, PGSIZE));
+    for (size_t i = 0; i < share_bucket_cnt; i++)
+        list_init(&share_buckets[i]);
+    frame_used = 0;
+
+    if (frame_low_watermark == FRAME_WATERMARK_DEFAULT)
+        frame_low_watermark = frame_cnt / 32;
+    if (frame_high_watermark == FRAME_WATERMARK_DEFAULT)
+        frame_high_watermark = frame_cnt / 16;
+    if (frame_high_watermark > frame_cnt)
+        frame_high_watermark = frame_cnt;
+    if (frame_high_watermark < frame_low_watermark)
+        frame_high_watermark = frame_low_watermark;
+    sema_init(&cleaner_wakeup, 0);
+    cleaner_awake = false;
+}
+
+/* Starts the page cleaner.  A low watermark of 0 disables it. */
+void frame_cleaner_start(void){
+    if (frame_low_watermark > 0)
+        thread_create("pagecleaner", PRI_DEFAULT, frame_cleaner, NULL);
+}
+
+/* Wakes the page cleaner if free frames ran below the low
+   watermark. */
+static void frame_check_watermark(void){
+    ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+    if (!cleaner_awake && frame_cnt - frame_used < frame_low_watermark) {
+        cleaner_awake = true;
+        sema_up(&cleaner_wakeup);
+    }
+}
+
+/* Page cleaner.  Writes victims back ahead of demand until the
+   high watermark of free frames is reached, so faults usually
+   find a free frame instead of paying for a swap write. */
+static void frame_cleaner(void *aux UNUSED){
+    for (;;) {
+        sema_down(&cleaner_wakeup);
+
+        lock_acquire(&frame_table_lock);
+        while (frame_cnt - frame_used < frame_high_watermark) {
+            struct frame_entry *f = frame_evict();
+
+            if (f == NULL)
+                break;
+            frame_remove(f);
+            palloc_free_page(f->page_ptr);
+        }
+        cleaner_awake = false;
+        lock_release(&frame_table_lock);
+    }
+}
+
+/* Load control scan over all threads. */
+struct load_scan {
+    struct thread *worst;               /* Running process faulting most. */
+    long long worst_faults;
+    size_t faulting;                    /* Running processes that faulted. */
+    struct thread *oldest;              /* Process suspended longest. */
+};
+
+static void frame_load_scan(struct thread *t, void *aux){
+    struct load_scan *s = aux;
+    long long faults = t->vmstat.major_faults - t->fault_mark;
+
+    t->fault_mark = t->vmstat.major_faults;
+    if (t->pagedir == NULL)
+        return;
+    if (t->suspended) {
+        if (s->oldest == NULL || t->suspended < s->oldest->suspended)
+            s->oldest = t;
+    } else if (faults > 0) {
+        s->faulting++;
+        if (faults > s->worst_faults) {
+            s->worst = t;
+            s->worst_faults = faults;
+        }
+    }
+}
+
+/* Lets suspended process T run again. */
+static void frame_resume(struct thread *t){
+    t->suspended = 0;
+    if (t->parked) {
+        t->parked = false;
+        thread_unblock(t);
+    }
+}
+
+/* Called by the timer interrupt on every tick.  Every
+   LOAD_INTERVAL ticks, compares the rate of major faults with
+   frame_thrash_rate.  Above it, the process faulting most is
+   suspended as long as another one keeps faulting, so that the
+   rest stop losing their pages to it.  Below half of it, the
+   process suspended longest is resumed.  One process at a time,
+   letting the load settle in between. */
+void frame_load_tick(void){
+    struct load_scan s = { NULL, 0, 0, NULL };
+    long long faults, limit;
+
+    /* Ticks folded in after a tickless idle may step over the
+       interval boundary. */
+    if (frame_thrash_rate == 0 || timer_ticks() / LOAD_INTERVAL == load_interval)
+        return;
+    load_interval = timer_ticks() / LOAD_INTERVAL;
+
+    faults = vmstat_total.major_faults - load_mark;
+    load_mark = vmstat_total.major_faults;
+    thread_foreach(frame_load_scan, &s);
+
+    limit = (long long) frame_thrash_rate * LOAD_INTERVAL / TIMER_FREQ;
+    if (faults > limit) {
+        if (s.worst != NULL && s.faulting > 1)
+            s.worst->suspended = timer_ticks();
+    } else if (faults < limit / 2 && s.oldest != NULL) {
+        frame_resume(s.oldest);
+    }
+}
+
+/* Blocks the current process while load control keeps it
+   suspended.  Called on page faults from user mode, where no
+   locks are held. */
+void frame_throttle(void){
+    struct thread *t = thread_current();
+    enum intr_level old_level = intr_disable();
+
+    while (t->suspended) {
+        t->parked = true;
+        thread_block();
+    }
+    intr_set_level(old_level);
+}
+
+/* Returns a user frame for PTE, owned by the current process.
+   When the user pool is exhausted a victim is evicted by the
+   clock algorithm.  The frame is returned pinned and loading, the
+   caller unpins it with frame_unpin() once the page is mapped. */
+struct frame_entry* frame_get_page(enum palloc_flags flag, struct page_table_entry *pte){
+    return frame_alloc(flag, pte, true);
+}
+
+/* Like frame_get_page(), but returns NULL rather than evicting
+   when no frame is free.  For speculative allocations. */
+struct frame_entry* frame_get_free_page(enum palloc_flags flag, struct page_table_entry *pte){
+    return frame_alloc(flag, pte, false);
+}
+
+static struct frame_entry* frame_alloc(enum palloc_flags flag, struct page_table_entry *pte, bool may_evict){
+    struct frame_entry *f;
+
+    lock_acquire(&frame_table_lock);
+    f = frame_take(flag, may_evict);
+    if (f != NULL)
+        list_push_back(&f->ptes, &pte->frame_elem);
+    lock_release(&frame_table_lock);
+
+    return f;
 }
 
-struct frame_entry* frame_get_page(enum palloc_flags flag){
-    struct thread* t = thread_current();
-    uint32_t *pd = t->pagedir;
+/* Returns an unused frame, pinned and loading, evicting if
+   MAY_EVICT.  Eviction drops the frame table lock for its I/O. */
+static struct frame_entry* frame_take(enum palloc_flags flag, bool may_evict){
+    struct frame_entry *f;
     void* paddr;
 
     ASSERT(flag & PAL_USER);
+    ASSERT(lock_held_by_current_thread(&frame_table_lock));
 
-    if((paddr = palloc_get_page(flag)) == NULL){
-        int min_lvl = 4;
-        struct frame_entry *target;
-        struct hash_iterator i;
-        
-        hash_first (&i, &frame_table);
-        while (hash_next (&i)) {
-            struct frame_entry *f = hash_entry (hash_cur (&i), struct frame_entry, h_elem);
-            bool accessed = pagedir_is_accessed (pd, f->page_ptr);
-            bool dirty = pagedir_is_accessed (pd, f->page_ptr);
-            int lvl = (accessed << 1) + dirty;
-            
-            if (!lvl) {
-                swap_out (f->pte);
-                return f;
-            }
-            else if (lvl < min_lvl){
-                min_lvl = lvl;
-                target = f;
+    if((paddr = palloc_get_page(flag)) != NULL){
+        f = frame_lookup(paddr);
+        frame_used++;
+    } else {
+        f = may_evict ? frame_evict() : NULL;
+        if (f == NULL)
+            return NULL;
+        if (flag & PAL_ZERO)
+            memset(f->page_ptr, 0, PGSIZE);
+    }
+
+    ASSERT(list_empty(&f->ptes));
+    f->state = FRAME_LOADING;
+    f->pin_cnt = 1;
+    frame_check_watermark();
+    return f;
+}
+
+/* Pins the frame of resident page PTE, so that it stays in memory
+   until frame_unpin(), for instance while a syscall does I/O on it.
+   Waits for an eviction of the page in progress to finish.  Returns
+   false if the page is not resident. */
+bool frame_pin(struct page_table_entry *pte){
+    struct frame_entry *f;
+    bool success = false;
+
+    lock_acquire(&frame_table_lock);
+    frame_wait(pte);
+    f = pte->kpage ? frame_lookup(pte->kpage) : NULL;
+    if (f && f->state == FRAME_RESIDENT) {
+        f->pin_cnt++;
+        success = true;
+    }
+    lock_release(&frame_table_lock);
+    return success;
+}
+
+/* Drops a pin of F.  A loading frame becomes resident. */
+void frame_unpin(struct frame_entry *f){
+    lock_acquire(&frame_table_lock);
+    ASSERT(f->pin_cnt > 0);
+    f->pin_cnt--;
+    f->state = FRAME_RESIDENT;
+    lock_release(&frame_table_lock);
+}
+
+/* Waits until the frame of PTE, if any, is not being evicted. */
+static void frame_wait(struct page_table_entry *pte){
+    struct frame_entry *f;
+
+    ASSERT(lock_held_by_current_thread(&frame_table_lock));
+    while (pte->kpage && (f = frame_lookup(pte->kpage)) != NULL
+           && f->state == FRAME_EVICTING)
+        cond_wait(&frame_evicted, &frame_table_lock);
+}
+
+/* Waits until PTE's page has finished any eviction in progress.
+   Afterwards it is either resident and mapped again or gone. */
+void frame_wait_evicted(struct page_table_entry *pte){
+    lock_acquire(&frame_table_lock);
+    frame_wait(pte);
+    lock_release(&frame_table_lock);
+}
+
+/* Returns true if any mapping of F was referenced since the last
+   call, clearing the accessed bits. */
+static bool frame_test_and_clear_accessed(struct frame_entry *f){
+    bool accessed = false;
+    struct list_elem *e;
+
+    for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e)) {
+        struct page_table_entry *pte = list_entry(e, struct page_table_entry, frame_elem);
+
+        if (pagedir_is_accessed(pte->pagedir, pte->upage)) {
+            pagedir_set_accessed(pte->pagedir, pte->upage, false);
+            swap_readahead_done(pte, true);
+            accessed = true;
+        }
+    }
+    return accessed;
+}
+
+/* Advances the clock hand collecting up to CNT frames that were
+   not referenced since the last sweep into VICTIMS, clearing
+   accessed bits of the frames passed over.  Victims are marked
+   evicting so they are not picked twice.  Returns the number
+   collected. */
+static size_t frame_pick_victims(struct frame_entry **victims, size_t cnt){
+    size_t found = 0;
+
+    /* Two full turns: the first may only clear accessed bits. */
+    for (size_t i = 0; i < 2 * frame_cnt && found < cnt; i++) {
+        struct frame_entry *f = &frame_table[clock_hand];
+
+        if (++clock_hand == frame_cnt)
+            clock_hand = 0;
+
+        if (f->state != FRAME_RESIDENT || f->pin_cnt > 0)
+            continue;
+        if (frame_test_and_clear_accessed(f))
+            continue;
+        f->state = FRAME_EVICTING;
+        victims[found++] = f;
+    }
+    return found;
+}
+
+/* Folds the dirty bit of PTE's mapping into PTE->dirty, which
+   survives unmapping and remapping. */
+static void frame_fold_dirty(struct page_table_entry *pte){
+    if (pagedir_is_dirty(pte->pagedir, pte->upage))
+        pte->dirty = true;
+}
+
+/* Unmaps PTE from its owner and returns whether the page differs
+   from its file.  Interrupts are off so that no write slips in
+   between. */
+static bool frame_unmap_dirty(struct page_table_entry *pte){
+    enum intr_level old_level;
+
+    swap_readahead_done(pte, pagedir_is_accessed(pte->pagedir, pte->upage));
+    old_level = intr_disable();
+    frame_fold_dirty(pte);
+    pagedir_clear_page(pte->pagedir, pte->upage);
+    intr_set_level(old_level);
+    return pte->dirty;
+}
+
+/* Unmaps F from every process mapping it.  Returns true if the
+   page may differ from its file, as recorded by the mappings'
+   dirty bits, which are folded into the entries. */
+static bool frame_unmap(struct frame_entry *f){
+    struct list_elem *e;
+    bool dirty = false;
+
+    for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e)) {
+        struct page_table_entry *pte = list_entry(e, struct page_table_entry, frame_elem);
+        if (frame_unmap_dirty(pte))
+            dirty = true;
+    }
+    return dirty;
+}
+
+/* Writes the resident page of PTE back to its file.  Must not be
+   called with frame_table_lock held. */
+static void frame_write_back(struct page_table_entry *pte){
+    ASSERT(!lock_held_by_current_thread(&frame_table_lock));
+    lock_acquire(&filesys_lock);
+    file_write_at(pte->file, pte->kpage, pte->page_read_bytes, pte->ofs);
+    lock_release(&filesys_lock);
+    pte->dirty = false;
+}
+
+/* Writes F, the frame of file mapping page PTE, back with
+   frame_table_lock dropped, as frame_evict does.  F is in the
+   evicting state meanwhile, so the clock passes over it and
+   anyone needing it waits for frame_evicted. */
+static void frame_flush(struct frame_entry *f, struct page_table_entry *pte){
+    ASSERT(lock_held_by_current_thread(&frame_table_lock));
+    ASSERT(f->state == FRAME_RESIDENT);
+
+    f->state = FRAME_EVICTING;
+    lock_release(&frame_table_lock);
+    frame_write_back(pte);
+    lock_acquire(&frame_table_lock);
+    f->state = FRAME_RESIDENT;
+    cond_broadcast(&frame_evicted, &frame_table_lock);
+}
+
+/* Detaches every entry from F, recording that its page now lives
+   in swap (IN_SWAP) or in its file.  In swap, the entries share
+   the slot of the first one. */
+static void frame_detach_all(struct frame_entry *f, bool in_swap){
+    struct page_table_entry *first = NULL;
+
+    while (!list_empty(&f->ptes)) {
+        struct page_table_entry *pte = list_entry(list_pop_front(&f->ptes),
+            struct page_table_entry, frame_elem);
+        if (first == NULL) {
+            first = pte;
+        } else if (in_swap) {
+            pte->swap_idx = first->swap_idx;
+            swap_dup(pte->swap_idx);
+        }
+        pte->kpage = NULL;
+        pte->loaded = in_swap;
+        VMSTAT_COUNT(pte->owner, evictions);
+    }
+}
+
+/* Returns the number of entries of F whose page is still in their
+   swap slot. */
+static size_t frame_cached_cnt(struct frame_entry *f){
+    struct list_elem *e;
+    size_t cnt = 0;
+
+    for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e))
+        if (list_entry(e, struct page_table_entry, frame_elem)->swap_cached)
+            cnt++;
+    return cnt;
+}
+
+/* Detaches every entry from clean F, each going back to the swap
+   slot it still holds. */
+static void frame_detach_cached(struct frame_entry *f){
+    while (!list_empty(&f->ptes)) {
+        struct page_table_entry *pte = list_entry(list_pop_front(&f->ptes),
+            struct page_table_entry, frame_elem);
+        ASSERT(pte->swap_cached);
+        pte->swap_cached = false;
+        pte->kpage = NULL;
+        pte->loaded = true;
+        VMSTAT_COUNT(pte->owner, evictions);
+    }
+}
+
+/* Releases the swap slots still held by entries of F, whose
+   contents changed. */
+static void frame_uncache(struct frame_entry *f){
+    struct list_elem *e;
+
+    for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e)) {
+        struct page_table_entry *pte = list_entry(e, struct page_table_entry, frame_elem);
+        if (pte->swap_cached) {
+            swap_free(pte->swap_idx);
+            pte->swap_cached = false;
+        }
+    }
+}
+
+/* Maps F again for all its entries, writable only for a sole
+   writable mapper. */
+static void frame_remap(struct frame_entry *f){
+    bool sole = list_size(&f->ptes) == 1;
+    struct list_elem *e;
+
+    for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e)) {
+        struct page_table_entry *pte = list_entry(e, struct page_table_entry, frame_elem);
+        pagedir_set_page(pte->pagedir, pte->upage, f->page_ptr, sole && !pte->readonly);
+    }
+}
+
+/* Evicts a batch of up to EVICT_BATCH victims chosen by the clock
+   algorithm and returns one of the freed frames.  The rest go
+   back to the user pool so the next faults find free memory.
+   File pages that were not written since they were read, such as
+   executable text, are simply dropped and read again on the next
+   fault, and so are pages not written since they were swapped in,
+   whose slot is still valid.  Dirty pages of file mappings are
+   written back to their file, and the others, anonymous or dirty,
+   are written to adjacent swap slots in one go.  Victims are unmapped
+   from their owners, whichever processes those are.  The lock is
+   released during the writes; victims stay in the evicting state
+   meanwhile and whoever needs one waits for frame_evicted.  Returns
+   NULL if every frame is pinned or swap is full. */
+static struct frame_entry* frame_evict(void){
+    struct frame_entry *victims[EVICT_BATCH], *swapped[EVICT_BATCH];
+    struct page_table_entry *ptes[EVICT_BATCH];
+    bool dirty[EVICT_BATCH];
+    struct frame_entry *ret = NULL;
+    size_t cnt, swap_cnt = 0, written, i;
+
+    ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+    /* One TLB flush for the whole sweep instead of one per page. */
+    pagedir_defer_begin();
+    cnt = frame_pick_victims(victims, EVICT_BATCH);
+
+    /* Unmap first so the owners can't dirty the pages while they
+       are being written out. */
+    for (i = 0; i < cnt; i++) {
+        struct frame_entry *f = victims[i];
+        struct page_table_entry *pte = list_entry(list_front(&f->ptes),
+            struct page_table_entry, frame_elem);
+
+        dirty[i] = false;
+        if (f->shared) {
+            frame_unmap(f);
+            frame_detach_all(f, false);
+            frame_unshare(f);
+        } else if (pte->writeback) {
+            ASSERT(list_size(&f->ptes) == 1);
+            dirty[i] = frame_unmap_dirty(pte);
+        } else {
+            bool clean = !frame_unmap(f);
+            size_t cached = frame_cached_cnt(f);
+
+            if (clean && cached == list_size(&f->ptes)) {
+                /* The swap cache still has the contents. */
+                frame_detach_cached(f);
+            } else if (clean && cached == 0 && pte->file != NULL) {
+                /* The file still has the contents. */
+                frame_detach_all(f, false);
+            } else {
+                /* One new slot, even if shared copy-on-write. */
+                frame_uncache(f);
+                ptes[swap_cnt] = pte;
+                swapped[swap_cnt++] = f;
             }
         }
-        swap_out (target->pte);
-        return target;
+    }
+    pagedir_defer_end();
+
+    lock_release(&frame_table_lock);
+    for (i = 0; i < cnt; i++)
+        if (dirty[i])
+            frame_write_back(list_entry(list_front(&victims[i]->ptes),
+                struct page_table_entry, frame_elem));
+    written = swap_out(ptes, swap_cnt);
+    lock_acquire(&frame_table_lock);
 
+    for (i = 0; i < swap_cnt; i++) {
+        struct frame_entry *f = swapped[i];
+
+        if (i >= written) {
+            struct list_elem *e;
+
+            /* frame_uncache() released their swap copies, so the
+               contents now live only here: not clean any more. */
+            for (e = list_begin(&f->ptes); e != list_end(&f->ptes); e = list_next(e))
+                list_entry(e, struct page_table_entry, frame_elem)->dirty = true;
+            frame_remap(f);
+            f->state = FRAME_RESIDENT;
+        } else {
+            VMSTAT_COUNT(ptes[i]->owner, swap_outs);
+            frame_detach_all(f, true);
+        }
     }
 
-    struct frame_entry *f = malloc(sizeof (struct frame_entry));
-    f->page_ptr = paddr;
-    hash_insert(&frame_table, &f->h_elem);
+    for (i = 0; i < cnt; i++) {
+        struct frame_entry *f = victims[i];
 
-    return f;
+        if (f->state != FRAME_EVICTING)
+            continue;
+        frame_detach_all(f, false);
+        if (ret == NULL) {
+            ret = f;
+        } else {
+            frame_remove(f);
+            palloc_free_page(f->page_ptr);
+        }
+    }
+    cond_broadcast(&frame_evicted, &frame_table_lock);
+    return ret;
+}
+
+/* Returns the number of frames in use. */
+size_t frame_used_cnt(void){
+    return frame_used;
+}
+
+/* Marks F unused.  Its entries must have been detached. */
+static void frame_remove(struct frame_entry *f){
+    ASSERT(list_empty(&f->ptes));
+    frame_used--;
+    if (f->shared)
+        frame_unshare(f);
+    f->state = FRAME_FREE;
+    f->pin_cnt = 0;
 }
 
 void frame_free_page(void *ptr){
     ASSERT(ptr);
-    
-    struct frame_entry f, *del;
-    struct hash_elem *e;
-
-    f.page_ptr = ptr;
 
-    e = hash_delete(&frame_table, &f.h_elem);
+    struct frame_entry *f;
 
-    if(e) {
-        del = hash_entry(e, struct frame_entry, h_elem);
-        free(del);
+    lock_acquire(&frame_table_lock);
+    f = frame_lookup(ptr);
+    if (f) {
+        list_init(&f->ptes);
+        frame_remove(f);
     }
     palloc_free_page (ptr);
+    lock_release(&frame_table_lock);
 }
 
-unsigned frame_hash (const struct hash_elem *p_, void *aux UNUSED){
-    const struct frame_entry *p = hash_entry (p_, struct frame_entry, h_elem);
-    return hash_bytes(&p->page_ptr, sizeof p->page_ptr);
+/* Releases whatever backs PTE, a frame or a swap slot, and
+   unmaps the page from its owner, writing it back first if it is
+   a dirty mapped file page.  A shared frame is freed only when its
+   last mapping goes away.  Used when PTE is destroyed. */
+void frame_release_page(struct page_table_entry *pte){
+    lock_acquire(&frame_table_lock);
+    frame_wait(pte);
+    if (pte->kpage) {
+        struct frame_entry *f = frame_lookup(pte->kpage);
+
+        ASSERT(f != NULL);
+        if (frame_unmap_dirty(pte) && pte->writeback)
+            frame_flush(f, pte);
+        list_remove(&pte->frame_elem);
+        if (list_empty(&f->ptes)) {
+            frame_remove(f);
+            palloc_free_page(f->page_ptr);
+        }
+        pte->kpage = NULL;
+        if (pte->swap_cached) {
+            swap_free(pte->swap_idx);
+            pte->swap_cached = false;
+        }
+    } else if (pte->loaded) {
+        swap_free(pte->swap_idx);
+    }
+    lock_release(&frame_table_lock);
 }
 
-bool frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
-    const struct frame_entry *a = hash_entry(a_, struct frame_entry, h_elem);
-    const struct frame_entry *b = hash_entry(b_, struct frame_entry, h_elem);
-    return a->page_ptr < b->page_ptr;
+static struct list* share_bucket(struct inode *inode, off_t ofs){
+    unsigned h = hash_bytes(&inode, sizeof inode) ^ hash_int(ofs);
+    return &share_buckets[h % share_bucket_cnt];
 }
 
-struct frame_entry* frame_lookup(const void *ptr){
-    struct frame_entry f;
-    struct hash_elem *e;
+/* Returns the shared frame holding the page of PTE's file at
+   PTE's offset, or NULL. */
+static struct frame_entry* share_lookup(struct page_table_entry *pte){
+    struct inode *inode = file_get_inode(pte->file);
+    struct list *bucket = share_bucket(inode, pte->ofs);
+    struct list_elem *e;
 
-    f.page_ptr = (void *)ptr;
-    e = hash_find(&frame_table, &f.h_elem);
-    return e != NULL ? hash_entry (e, struct frame_entry, h_elem) : NULL;
+    for (e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+        struct frame_entry *f = list_entry(e, struct frame_entry, share_elem);
+        if (f->inode == inode && f->ofs == pte->ofs && f->read_bytes == pte->page_read_bytes)
+            return f;
+    }
+    return NULL;
+}
+
+static void frame_unshare(struct frame_entry *f){
+    ASSERT(f->shared);
+    list_remove(&f->share_elem);
+    f->shared = false;
 }
 
-void frame_free_entry (struct hash_elem *element, void *aux UNUSED){
-    struct frame_entry* pte = hash_entry (element, struct frame_entry, h_elem);
-    palloc_free_page(pte->page_ptr);
-    free(pte);
-}
\ No newline at end of file
+/* Maps read-only file page PTE onto a frame another process
+   already loaded, if there is one and it is resident.  Returns
+   true on success. */
+bool frame_map_shared(struct page_table_entry *pte){
+    struct frame_entry *f;
+    bool success = false;
+
+    ASSERT(pte->readonly && pte->file != NULL);
+
+    lock_acquire(&frame_table_lock);
+    f = share_lookup(pte);
+    if (f && f->state == FRAME_RESIDENT && pagedir_set_page(pte->pagedir, pte->upage, f->page_ptr, false)) {
+        list_push_back(&f->ptes, &pte->frame_elem);
+        pte->kpage = f->page_ptr;
+        pte->loaded = true;
+        success = true;
+    }
+    lock_release(&frame_table_lock);
+    return success;
+}
+
+/* Makes CHILD, the entry of a process being forked, share what
+   backs PARENT, its counterpart in the parent process.  A frame is
+   shared copy-on-write, write-protecting the parent's mapping too;
+   a swap slot gains a reference.  Dirty pages of a file mapping
+   are written back instead, CHILD then reads the file.  Returns
+   false if CHILD could not be mapped. */
+bool frame_fork_page(struct page_table_entry *parent, struct page_table_entry *child){
+    bool success = true;
+
+    lock_acquire(&frame_table_lock);
+    frame_wait(parent);
+    if (parent->kpage && parent->writeback) {
+        frame_fold_dirty(parent);
+        if (parent->dirty) {
+            pagedir_set_dirty(parent->pagedir, parent->upage, false);
+            frame_flush(frame_lookup(parent->kpage), parent);
+        }
+    } else if (parent->kpage) {
+        struct frame_entry *f = frame_lookup(parent->kpage);
+
+        ASSERT(f != NULL);
+        frame_fold_dirty(parent);
+        child->dirty = parent->dirty;
+        if (!parent->readonly) {
+            pagedir_clear_page(parent->pagedir, parent->upage);
+            pagedir_set_page(parent->pagedir, parent->upage, parent->kpage, false);
+        }
+        success = pagedir_set_page(child->pagedir, child->upage, parent->kpage, false);
+        if (success) {
+            list_push_back(&f->ptes, &child->frame_elem);
+            child->kpage = parent->kpage;
+            child->loaded = true;
+            if (parent->swap_cached) {
+                swap_dup(parent->swap_idx);
+                child->swap_idx = parent->swap_idx;
+                child->swap_cached = true;
+            }
+        }
+    } else if (parent->loaded) {
+        child->dirty = parent->dirty;
+        swap_dup(parent->swap_idx);
+        child->swap_idx = parent->swap_idx;
+        child->loaded = true;
+    }
+    lock_release(&frame_table_lock);
+    return success;
+}
+
+/* Handles a write to PTE's page while its frame is shared
+   copy-on-write.  The last remaining mapper takes the frame over,
+   others get a private copy.  Returns false if PTE is not such a
+   page or no frame is available.  If the page was evicted in the
+   meantime, returns true so that the access faults it back in. */
+bool frame_cow(struct page_table_entry *pte){
+    struct frame_entry *f;
+    bool success = false;
+
+    lock_acquire(&frame_table_lock);
+    frame_wait(pte);
+    if (pte->kpage == NULL) {
+        success = true;
+        goto done;
+    }
+    f = frame_lookup(pte->kpage);
+    if (f == NULL || pte->readonly || pte->writeback)
+        goto done;
+
+    if (list_size(&f->ptes) > 1) {
+        struct frame_entry *copy;
+
+        /* Keep the original from being evicted to make room. */
+        f->pin_cnt++;
+        copy = frame_take(PAL_USER, true);
+        f->pin_cnt--;
+        if (copy == NULL)
+            goto done;
+        memcpy(copy->page_ptr, f->page_ptr, PGSIZE);
+        list_remove(&pte->frame_elem);
+        list_push_back(&copy->ptes, &pte->frame_elem);
+        pte->kpage = copy->page_ptr;
+        copy->pin_cnt = 0;
+        copy->state = FRAME_RESIDENT;
+    }
+    swap_readahead_done(pte, true);
+    frame_fold_dirty(pte);
+    pagedir_clear_page(pte->pagedir, pte->upage);
+    success = pagedir_set_page(pte->pagedir, pte->upage, pte->kpage, true);
+
+done:
+    lock_release(&frame_table_lock);
+    return success;
+}
+
+/* Publishes F, just loaded from read-only file page PTE and made
+   resident, in the share cache.  If another process published the
+   same page in the meantime, or F was evicted already, F simply
+   stays private. */
+void frame_share(struct frame_entry *f, struct page_table_entry *pte){
+    ASSERT(pte->readonly && pte->file != NULL);
+
+    lock_acquire(&frame_table_lock);
+    if (!f->shared && f->state == FRAME_RESIDENT && pte->kpage == f->page_ptr
+        && share_lookup(pte) == NULL) {
+        f->inode = file_get_inode(pte->file);
+        f->ofs = pte->ofs;
+        f->read_bytes = pte->page_read_bytes;
+        f->shared = true;
+        list_push_back(share_bucket(f->inode, f->ofs), &f->share_elem);
+    }
+    lock_release(&frame_table_lock);
+}
+
+/* Returns the frame descriptor for user pool page PTR, or NULL if
+   PTR is not in the user pool. */
+struct frame_entry* frame_lookup(const void *ptr){
+    size_t idx;
+
+    if ((const uint8_t *)ptr < frame_base)
+        return NULL;
+    idx = pg_no(ptr) - pg_no(frame_base);
+    return idx < frame_cnt ? &frame_table[idx] : NULL;
+}
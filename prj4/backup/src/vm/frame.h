@@ -1,28 +1,74 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
-#include <hash.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <list.h>
 #include <debug.h>
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 
-struct frame_entry {
-    void *page_ptr;
-    struct hash_elem h_elem;
-    struct page_table_entry* pte;
+struct page_table_entry;
+struct inode;
+
+/* One descriptor per page of the user pool, indexed by the
+   page's position in the pool.  A frame is in use while at least
+   one supplemental page entry maps it.  Several entries map it if
+   it is a shared executable page or, after fork, a copy-on-write
+   page, which is mapped read-only until written. */
+enum frame_state {
+    FRAME_FREE,                         /* In the user pool. */
+    FRAME_LOADING,                      /* Being filled by a fault. */
+    FRAME_RESIDENT,                     /* Mapped, may be chosen as a victim. */
+    FRAME_EVICTING                      /* Being written out, wait for it. */
 };
 
-struct hash frame_table;
-struct lock frame_table_lock;
+struct frame_entry {
+    void *page_ptr;                     /* Kernel virtual address of the frame. */
+    struct list ptes;                   /* Entries mapping this frame (reverse map). */
+    enum frame_state state;
+    unsigned pin_cnt;                   /* Never chosen as a victim while nonzero. */
 
-void frame_init(void);
-struct frame_entry* frame_get_page(enum palloc_flags flag);
-void frame_free_page(void *ptr);
+    /* Read-only file page shared through the share cache. */
+    bool shared;                        /* In the share cache? */
+    struct inode *inode;                /* Backing file. */
+    off_t ofs;                          /* Offset within the file. */
+    size_t read_bytes;                  /* Bytes read, the rest is zero. */
+    struct list_elem share_elem;        /* Element in a share cache bucket. */
+};
+
+/* Free user frame thresholds, in pages, for the page cleaner.
+   It wakes when fewer than the low watermark are free and evicts
+   until the high watermark is reached.  Set by the kernel command
+   line options "-wmlow" and "-wmhigh". */
+#define FRAME_WATERMARK_DEFAULT SIZE_MAX
+extern size_t frame_low_watermark;
+extern size_t frame_high_watermark;
 
-hash_action_func frame_free_entry;
+/* Load control.  Major faults per second above which the process
+   faulting most is suspended, letting the others keep their
+   working sets resident.  Zero disables it.  Set by the kernel
+   command line option "-thrash". */
+#define FRAME_THRASH_DEFAULT 512
+extern unsigned frame_thrash_rate;
 
-unsigned frame_hash (const struct hash_elem *p_, void *aux UNUSED);
-bool frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
+void frame_init(void *user_base, size_t user_pages);
+void frame_cleaner_start(void);
+struct frame_entry* frame_get_page(enum palloc_flags flag, struct page_table_entry *pte);
+struct frame_entry* frame_get_free_page(enum palloc_flags flag, struct page_table_entry *pte);
+bool frame_pin(struct page_table_entry *pte);
+void frame_unpin(struct frame_entry *f);
+void frame_wait_evicted(struct page_table_entry *pte);
+void frame_free_page(void *ptr);
+void frame_release_page(struct page_table_entry *pte);
+bool frame_map_shared(struct page_table_entry *pte);
+bool frame_fork_page(struct page_table_entry *parent, struct page_table_entry *child);
+bool frame_cow(struct page_table_entry *pte);
+void frame_share(struct frame_entry *f, struct page_table_entry *pte);
 struct frame_entry* frame_lookup(const void *ptr);
+size_t frame_used_cnt(void);
+void frame_load_tick(void);
+void frame_throttle(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,13 +1,36 @@
 #include "page.h"
+#include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/malloc.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
 #include "threads/vaddr.h"
+#include "userprog/exception.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 
 bool install_page(void *upage, void *kpage, bool writable);
 
+/* Most neighbouring pages populated by a single fault. */
+#define FAULT_AROUND_MAX 8
+
+struct vmstat vmstat_total;
+
+/* Most pages swapped in ahead of a swap-in fault. */
+#define SWAP_AHEAD_MAX 8
+
+static bool page_read_file (struct page_table_entry *pte, uint8_t *kpage);
+static void page_fault_around (struct page_table_entry *pte);
+static void page_swap_ahead (struct page_table_entry *pte);
+static struct page_table_entry* page_from_vma (struct vm_area *vma, uint8_t *upage);
+static void page_discard (struct page_table_entry *pte);
+
+/* A page of zeros mapped read-only for read faults on zero-fill
+   pages that were never written.  The first write replaces it by a
+   private frame, see page_cow_handler(). */
+static uint8_t *zero_page;
+
 /*  functions for building hash table */
 
 unsigned page_hash (const struct hash_elem *p_, void *aux UNUSED){
@@ -34,6 +57,144 @@ struct page_table_entry* page_lookup(struct hash* page_table, const void *upage)
 
 /*      end     */
 
+/* Adds the area of SIZE bytes at START, whose first READ_BYTES
+   bytes come from FILE at OFS, to AREAS.  Returns NULL if it
+   overlaps an existing area or memory is exhausted. */
+struct vm_area* vma_create (struct list* areas, uint8_t *start, size_t size,
+    struct file *file, off_t ofs, size_t read_bytes, bool read_only){
+    struct vm_area *vma;
+    struct list_elem *e;
+
+    ASSERT (pg_ofs (start) == 0);
+    ASSERT (size % PGSIZE == 0);
+
+    for (e = list_begin(areas); e != list_end(areas); e = list_next(e)) {
+        struct vm_area *v = list_entry(e, struct vm_area, elem);
+        if (start + size <= v->start) break;
+        if (start < v->end) return NULL;
+    }
+
+    vma = malloc(sizeof *vma);
+    if (!vma) return NULL;
+    vma->start = start;
+    vma->end = start + size;
+    vma->file = file;
+    vma->ofs = ofs;
+    vma->read_bytes = read_bytes;
+    vma->readonly = read_only;
+    vma->mapid = 0;
+    list_insert(e, &vma->elem);
+    return vma;
+}
+
+/* Returns the area of AREAS containing ADDR, or NULL. */
+struct vm_area* vma_find (struct list* areas, const void *addr){
+    struct list_elem *e;
+
+    for (e = list_begin(areas); e != list_end(areas); e = list_next(e)) {
+        struct vm_area *v = list_entry(e, struct vm_area, elem);
+        if ((const uint8_t *)addr < v->start) break;
+        if ((const uint8_t *)addr < v->end) return v;
+    }
+    return NULL;
+}
+
+/* Frees every area of AREAS, closing the files of mappings.  Their
+   pages must have been released already. */
+void vma_destroy (struct list* areas){
+    while (!list_empty(areas)) {
+        struct vm_area *v = list_entry(list_pop_front(areas), struct vm_area, elem);
+        if (v->mapid) {
+            lock_acquire(&filesys_lock);
+            file_close(v->file);
+            lock_release(&filesys_lock);
+        }
+        free(v);
+    }
+}
+
+/* Maps FILE, which the mapping reopens, at page-aligned ADDR of the
+   current process.  Pages are read on first access and written back
+   only if dirty.  Returns the mapping id, or -1 if ADDR is not
+   suitable or the range overlaps mapped memory. */
+int page_mmap (struct file *file, void *addr){
+    struct vm_area *vma;
+    off_t length = file_length(file);
+
+    if (length == 0 || addr == NULL || pg_ofs(addr) != 0 || !is_user_vaddr(addr)
+        || (size_t)length > (size_t)((uint8_t *)PHYS_BASE - (uint8_t *)addr))
+        return -1;
+
+    file = file_reopen(file);
+    if (!file) return -1;
+    vma = vma_create(&thread_current()->vm_areas, addr, ROUND_UP(length, PGSIZE),
+                     file, 0, length, false);
+    if (!vma) {
+        file_close(file);
+        return -1;
+    }
+    vma->mapid = pg_no(addr);
+    return vma->mapid;
+}
+
+/* Removes mapping MAPID of the current process, writing its dirty
+   pages back.  Returns false if there is no such mapping.  Areas
+   not created by mmap have mapid 0 and are never removed. */
+bool page_munmap (int mapid){
+    struct thread *t = thread_current();
+    struct list_elem *e;
+
+    if (mapid <= 0)
+        return false;
+    for (e = list_begin(&t->vm_areas); e != list_end(&t->vm_areas); e = list_next(e)) {
+        struct vm_area *v = list_entry(e, struct vm_area, elem);
+        uint8_t *upage;
+
+        if (v->mapid != mapid) continue;
+
+        for (upage = v->start; upage < v->end; upage += PGSIZE) {
+            struct page_table_entry *pte = page_lookup(t->page_table, upage);
+            if (pte) {
+                hash_delete(t->page_table, &pte->h_elem);
+                page_free_entry(&pte->h_elem, NULL);
+            }
+        }
+        list_remove(&v->elem);
+        lock_acquire(&filesys_lock);
+        file_close(v->file);
+        lock_release(&filesys_lock);
+        free(v);
+        return true;
+    }
+    return false;
+}
+
+/* Extends the stack area down to the page of FAULT_ADDR.  The
+   caller decides whether the access looks like a stack access. */
+bool page_grow_stack (void* fault_addr){
+    struct list *areas = &thread_current()->vm_areas;
+    struct vm_area *stack = vma_find(areas, (uint8_t *)PHYS_BASE - 1);
+    uint8_t *upage = pg_round_down(fault_addr);
+
+    if (!stack) return false;
+    if (upage >= stack->start) return true;
+    if (&stack->elem != list_begin(areas)
+        && list_entry(list_prev(&stack->elem), struct vm_area, elem)->end > upage)
+        return false;
+    stack->start = upage;
+    return true;
+}
+
+void page_init (void){
+    zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+}
+
+/* Returns true if PTE's contents are all zeros until written:
+   anonymous pages and bss pages never loaded. */
+static bool page_is_zero_fill (const struct page_table_entry *pte){
+    return !pte->loaded && (pte->file == NULL || pte->page_read_bytes == 0);
+}
+
 void page_init_table (struct hash** page_table){
     *page_table = malloc(sizeof (struct hash));
     hash_init(*page_table, page_hash, page_less, NULL);
@@ -54,6 +215,8 @@ struct page_table_entry* page_entry (struct file *file, off_t ofs, uint8_t *upag
     upage = pg_round_down((const void *)upage);
 
     struct page_table_entry* pte = malloc (sizeof (struct page_table_entry));
+    pte->owner = thread_current();
+    pte->pagedir = thread_current()->pagedir;
     pte->file = file;
     pte->ofs = ofs;
     pte->upage = upage;
@@ -62,63 +225,380 @@ struct page_table_entry* page_entry (struct file *file, off_t ofs, uint8_t *upag
     pte->page_zero_bytes = page_zero_bytes;
     pte->readonly = read_only;
     pte->loaded = false;
+    pte->writeback = false;
+    pte->dirty = false;
+    pte->swap_cached = false;
+    pte->readahead = false;
 
     return pte;
 }
 
+/* Creates the entry for UPAGE in VMA on its first fault. */
+static struct page_table_entry* page_from_vma (struct vm_area *vma, uint8_t *upage){
+    struct page_table_entry *pte;
+    size_t ofs = upage - vma->start;
+    size_t read_bytes = 0;
+
+    if (vma->read_bytes > ofs)
+        read_bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+    pte = page_create_and_insert_entry(thread_current()->page_table, vma->file,
+        vma->ofs + ofs, upage, read_bytes, PGSIZE - read_bytes, vma->readonly);
+    if (pte)
+        pte->writeback = vma->mapid != 0;
+    return pte;
+}
+
+/* Returns the entry for UPAGE, creating it if UPAGE lies in one of
+   the current process's areas. */
+static struct page_table_entry* page_get (uint8_t *upage){
+    struct thread *t = thread_current();
+    struct page_table_entry *pte = page_lookup(t->page_table, upage);
+    struct vm_area *vma;
+
+    if (pte) return pte;
+    vma = vma_find(&t->vm_areas, upage);
+    return vma ? page_from_vma(vma, upage) : NULL;
+}
+
+/* Drops PTE, which maps no frame and holds no swap slot. */
+static void page_discard (struct page_table_entry *pte){
+    hash_delete(thread_current()->page_table, &pte->h_elem);
+    free(pte);
+}
+
+/* Fills KPAGE with PTE's contents from its file. */
+static bool page_read_file (struct page_table_entry *pte, uint8_t *kpage){
+    if (file_read_at(pte->file, kpage, pte->page_read_bytes, pte->ofs) != (int)pte->page_read_bytes)
+        return false;
+    memset(kpage + pte->page_read_bytes, 0, pte->page_zero_bytes);
+    pte->dirty = false;
+    return true;
+}
+
+/* Maps the file-backed pages following PTE, which was just faulted
+   in from its file, as long as they are not loaded yet and
+   continue the same file contiguously.  The window doubles while
+   faults keep landing right after the previous window and halves
+   otherwise.  Only free frames are used, never evicting for a
+   guess; unused guesses have a clear accessed bit and are the
+   first victims of the clock. */
+static void page_fault_around (struct page_table_entry *pte){
+    struct thread *t = thread_current();
+    struct vm_area *vma = vma_find(&t->vm_areas, pte->upage);
+    uint8_t *upage = pte->upage + PGSIZE;
+    size_t i;
+
+    if (pte->upage == t->fault_next) {
+        t->fault_around = t->fault_around ? t->fault_around * 2 : 1;
+        if (t->fault_around > FAULT_AROUND_MAX)
+            t->fault_around = FAULT_AROUND_MAX;
+    } else {
+        t->fault_around /= 2;
+    }
+
+    for (i = 0; i < t->fault_around && vma && upage < vma->end; i++, upage += PGSIZE) {
+        struct page_table_entry *next;
+        struct frame_entry *frame;
+
+        /* Stop at pages already touched and at the zero tail. */
+        if ((size_t)(upage - vma->start) >= vma->read_bytes
+            || page_lookup(t->page_table, upage))
+            break;
+        next = page_from_vma(vma, upage);
+        if (!next)
+            break;
+
+        if (next->readonly && frame_map_shared(next))
+            continue;
+        frame = frame_get_free_page(PAL_USER, next);
+        if (!frame) {
+            page_discard(next);
+            break;
+        }
+        next->kpage = frame->page_ptr;
+        if (!page_read_file(next, next->kpage)
+            || !install_page(next->upage, next->kpage, !next->readonly)) {
+            next->kpage = NULL;
+            frame_free_page(frame->page_ptr);
+            page_discard(next);
+            break;
+        }
+        next->loaded = true;
+        if (next->readonly)
+            frame_share(frame, next);
+        frame_unpin(frame);
+    }
+    t->fault_next = upage;
+}
+
+/* Swaps in the pages following PTE, which was just read from
+   swap, as long as they sit in the slots following its own, where
+   the eviction batch that took PTE out put its neighbours.  Like
+   fault-around this only uses free frames.  The pages are mapped
+   with a clear accessed bit, which tells later whether the guess
+   was used. */
+static void page_swap_ahead (struct page_table_entry *pte){
+    struct page_table_entry *ptes[SWAP_AHEAD_MAX];
+    struct frame_entry *frames[SWAP_AHEAD_MAX];
+    struct hash *page_table = thread_current()->page_table;
+    uint8_t *upage = pte->upage + PGSIZE;
+    size_t cnt, i;
+
+    for (cnt = 0; cnt < SWAP_AHEAD_MAX && is_user_vaddr(upage); cnt++, upage += PGSIZE) {
+        struct page_table_entry *next = page_lookup(page_table, upage);
+
+        if (!next || next->kpage != NULL || !next->loaded
+            || next->swap_idx != pte->swap_idx + cnt + 1)
+            break;
+        frames[cnt] = frame_get_free_page(PAL_USER, next);
+        if (!frames[cnt])
+            break;
+        next->kpage = frames[cnt]->page_ptr;
+        ptes[cnt] = next;
+    }
+    if (cnt == 0)
+        return;
+
+    swap_in_ahead(ptes, cnt);
+    for (i = 0; i < cnt; i++) {
+        struct page_table_entry *next = ptes[i];
+
+        if (!install_page(next->upage, next->kpage, !next->readonly)) {
+            swap_readahead_done(next, false);
+            next->kpage = NULL;
+            frame_free_page(frames[i]->page_ptr);
+            continue;
+        }
+        next->swap_cached = true;
+        next->dirty = false;
+        VMSTAT_COUNT(next->owner, swap_ins);
+        frame_unpin(frames[i]);
+    }
+}
+
 bool page_fault_handler (void* fault_addr, bool write) {
     struct frame_entry* frame;
     uint8_t *kpage;
+    bool from_file = false, from_swap = false;
 
     fault_addr = pg_round_down((const void *)fault_addr);
 
     // ASSERT (pg_ofs (fault_addr) == 0);
-    struct hash *page_table = thread_current() -> page_table;
-    struct page_table_entry *pte = page_lookup(page_table, (const void *)fault_addr);
-    
+    struct page_table_entry *pte = page_get(fault_addr);
+
     if(!pte || (pte->readonly && write)) return false;
-    frame = frame_get_page(PAL_USER);
-    frame->pte = pte;
-    kpage = frame->page_ptr;
 
-    if (!kpage) return false;
+    /* The page may be on its way out to swap or its file.  If the
+       eviction failed it is mapped again, just retry. */
+    frame_wait_evicted(pte);
+    if (pte->kpage != NULL && pte->kpage != zero_page) {
+        VMSTAT_COUNT(pte->owner, minor_faults);
+        return true;
+    }
+
+    /* Reading untouched zero-fill memory costs no frame. */
+    if (!write && pte->kpage == NULL && page_is_zero_fill(pte)) {
+        if (!install_page(fault_addr, zero_page, false)) return false;
+        pte->kpage = zero_page;
+        VMSTAT_COUNT(pte->owner, minor_faults);
+        return true;
+    }
+
+    /* Another process running the same executable may already
+       have this read-only page in memory. */
+    if (pte->readonly && pte->file && !pte->loaded && frame_map_shared(pte)) {
+        VMSTAT_COUNT(pte->owner, minor_faults);
+        page_fault_around(pte);
+        return true;
+    }
+
+    /* Fresh anonymous pages come zeroed, usually by the idle thread. */
+    frame = frame_get_page(pte->loaded || pte->file ? PAL_USER : PAL_USER | PAL_ZERO, pte);
+    if (!frame) return false;
+    kpage = frame->page_ptr;
+    pte->kpage = kpage;
 
     if(pte->loaded){
         swap_in (pte);
+        pte->swap_cached = true;
+        pte->dirty = false;
+        VMSTAT_COUNT(pte->owner, swap_ins);
+        from_swap = true;
     } else{
         if(pte->file){
-            file_seek(pte->file, pte->ofs);
-            if (file_read(pte->file, kpage, pte->page_read_bytes) != (int)pte->page_read_bytes) {
+            if (!page_read_file(pte, kpage)) {
+                pte->kpage = NULL;
                 frame_free_page(kpage);
                 return false;
             }
-            memset(kpage + pte->page_read_bytes, 0, pte->page_zero_bytes);
-        } 
+            from_file = true;
+        }
         pte->loaded = true;
     }
 
     if (!install_page(fault_addr, kpage, !pte->readonly)) {
+      pte->kpage = NULL;
       frame_free_page(kpage);
       return false;
     }
-    pte->kpage = kpage;
+    frame_unpin(frame);
+    if (from_file && pte->readonly)
+        frame_share(frame, pte);
+
+    if (from_file || from_swap)
+        VMSTAT_COUNT(pte->owner, major_faults);
+    else
+        VMSTAT_COUNT(pte->owner, minor_faults);
+    if (from_file)
+        page_fault_around(pte);
+    else if (from_swap)
+        page_swap_ahead(pte);
     return true;
 }
 
-bool page_copy_table (struct hash* from, struct hash* to){
+/* Handles a write to a present but write-protected user page by
+   giving the page a private frame, if it is mapped onto the zero
+   page or shared copy-on-write after fork.  Returns false for any
+   other protection fault. */
+bool page_cow_handler (void* fault_addr) {
+    struct page_table_entry *pte;
+
+    fault_addr = pg_round_down((const void *)fault_addr);
+    pte = page_lookup(thread_current()->page_table, fault_addr);
+    if (!pte || pte->readonly) return false;
+    if (pte->kpage != zero_page) {
+        VMSTAT_COUNT(pte->owner, minor_faults);
+        return frame_cow(pte);
+    }
+
+    pagedir_clear_page(pte->pagedir, pte->upage);
+    pte->kpage = NULL;
+    return page_fault_handler(fault_addr, true);
+}
+
+/* Faults in the page of user address UADDR, writable if WRITE,
+   and pins it so that it stays resident until page_unpin().  Lets
+   syscalls do file I/O straight on user buffers.  Returns false if
+   UADDR is not accessible. */
+bool page_pin (const void *uaddr, bool write){
+    struct page_table_entry *pte;
+    uint8_t c;
+
+    for (;;) {
+        if (copy_from_user(&c, uaddr, 1) != 0) return false;
+        if (write && copy_to_user((void *)uaddr, &c, 1) != 0) return false;
+
+        pte = page_lookup(thread_current()->page_table, pg_round_down(uaddr));
+        ASSERT(pte != NULL);
+        if (pte->kpage == zero_page || frame_pin(pte))
+            return true;
+        /* Evicted right after the touch, frame_pin() having waited
+           for the eviction to finish: fault it in again. */
+    }
+}
+
+/* Undoes page_pin() for UADDR. */
+void page_unpin (const void *uaddr){
+    struct page_table_entry *pte = page_lookup(thread_current()->page_table,
+                                               pg_round_down(uaddr));
+
+    ASSERT(pte != NULL && pte->kpage != NULL);
+    if (pte->kpage != zero_page)
+        frame_unpin(frame_lookup(pte->kpage));
+}
+
+/* Stores the paging statistics of the current process in SELF and
+   those of the system in TOTAL. */
+void page_get_stats (struct vmstat *self, struct vmstat *total){
+    struct thread *t = thread_current();
+    struct hash_iterator i;
+
+    *self = t->vmstat;
+    self->resident_pages = 0;
+    hash_first(&i, t->page_table);
+    while (hash_next(&i)) {
+        struct page_table_entry *pte = hash_entry(hash_cur(&i), struct page_table_entry, h_elem);
+        if (pte->kpage != NULL && pte->kpage != zero_page)
+            self->resident_pages++;
+    }
+
+    *total = vmstat_total;
+    total->resident_pages = frame_used_cnt();
+}
+
+void page_print_stats (void){
+    printf ("Paging: %lld minor faults, %lld major faults, %lld swap-ins, "
+            "%lld swap-outs, %lld evictions\n", vmstat_total.minor_faults,
+            vmstat_total.major_faults, vmstat_total.swap_ins,
+            vmstat_total.swap_outs, vmstat_total.evictions);
+}
+
+/* Gives the current process, just created by fork, the address
+   space of PARENT: a copy of its areas plus an entry for every
+   page PARENT has touched, sharing the frame or swap slot behind
+   it.  Costs time in the number of entries, not in memory size.
+   The current process's exec_file must already be its own copy
+   of PARENT's.  PARENT must be blocked until this returns. */
+bool page_fork (struct thread *parent){
+    struct thread *t = thread_current();
+    struct hash_iterator i;
+
+    if (!page_copy_table(&parent->vm_areas, &t->vm_areas, t->exec_file))
+        return false;
+
+    hash_first(&i, parent->page_table);
+    while (hash_next(&i)) {
+        struct page_table_entry *from = hash_entry(hash_cur(&i), struct page_table_entry, h_elem);
+        struct vm_area *vma = vma_find(&t->vm_areas, from->upage);
+        struct page_table_entry *pte;
+
+        /* The parent's files may be closed before ours. */
+        ASSERT(from->file == NULL || vma != NULL);
+        pte = page_create_and_insert_entry(t->page_table,
+            from->file ? vma->file : NULL, from->ofs, from->upage,
+            from->page_read_bytes, from->page_zero_bytes, from->readonly);
+
+        if (!pte) return false;
+        pte->writeback = from->writeback;
+        if (from->kpage == zero_page) {
+            if (!pagedir_set_page(t->pagedir, pte->upage, zero_page, false))
+                return false;
+            pte->kpage = zero_page;
+        } else if (!frame_fork_page(from, pte)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Gives TO a copy of the areas in FROM.  Pages are faulted in
+   from the copies as they are touched.  Executable segments of
+   the copies are backed by EXEC_FILE and mappings by a new
+   opening of their file, so that TO does not depend on files of
+   FROM's process. */
+bool page_copy_table (struct list* from, struct list* to, struct file *exec_file){
+    struct list_elem *e;
 
     ASSERT(from != NULL);
     ASSERT(to != NULL);
-    
-    hash_clear(to, page_free_entry);
-    struct hash_iterator i;
-    struct page_table_entry *pte, *tmp;
-    hash_first (&i, from);
-    while (hash_next (&i)){
-        pte = hash_entry (hash_cur (&i), struct page_table_entry, h_elem);
-        tmp = page_entry (pte->file, pte->ofs, pte->upage, pte->page_read_bytes, 
-            pte->page_zero_bytes, pte->readonly);
-        hash_insert(to, &tmp->h_elem);
+
+    vma_destroy(to);
+    for (e = list_begin(from); e != list_end(from); e = list_next(e)) {
+        struct vm_area *v = list_entry(e, struct vm_area, elem);
+        struct vm_area *copy;
+        struct file *file = v->mapid ? file_reopen(v->file)
+                            : v->file ? exec_file : NULL;
+
+        if (v->file && !file)
+            return false;
+        copy = vma_create(to, v->start, v->end - v->start, file, v->ofs,
+                          v->read_bytes, v->readonly);
+        if (!copy) {
+            if (v->mapid)
+                file_close(file);
+            return false;
+        }
+        copy->mapid = v->mapid;
     }
 
     return true;
@@ -126,6 +606,11 @@ bool page_copy_table (struct hash* from, struct hash* to){
 
 void page_free_entry (struct hash_elem *element, void *aux UNUSED){
     struct page_table_entry* pte = hash_entry (element, struct page_table_entry, h_elem);
+    if (pte->kpage == zero_page) {
+        pagedir_clear_page(pte->pagedir, pte->upage);
+        pte->kpage = NULL;
+    }
+    frame_release_page(pte);
     free(pte);
 }
 
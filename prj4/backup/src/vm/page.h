@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <hash.h>
+#include <list.h>
 #include <debug.h>
 
 #include "threads/thread.h"
@@ -11,6 +12,8 @@
 #include "filesys/file.h"
 
 struct page_table_entry {
+    struct thread *owner;               /* Process the page belongs to. */
+    uint32_t *pagedir;                  /* Owner's page directory. */
     struct file *file;
     off_t ofs;
     uint8_t *upage;
@@ -19,18 +22,60 @@ struct page_table_entry {
     size_t page_zero_bytes;
     bool readonly;
     bool loaded;
+    bool writeback;                     /* Dirty contents go back to FILE, not to swap. */
+    bool dirty;                         /* Differs from its copy, beyond the PTE's dirty bit. */
+    bool swap_cached;                   /* Resident, and still at SWAP_IDX. */
+    bool readahead;                     /* Swapped in ahead, use not seen yet. */
     size_t swap_idx;
 
     struct hash_elem h_elem;
+    struct list_elem frame_elem;        /* Element in the frame's reverse map. */
 };
 
+/* A range of a process's address space, backed by a file or
+   anonymous.  Pages of an area get a page_table_entry only once
+   they are faulted in. */
+struct vm_area {
+    uint8_t *start;                     /* First page. */
+    uint8_t *end;                       /* Page after the last one. */
+    struct file *file;                  /* Backing file, or NULL. */
+    off_t ofs;                          /* Offset of START in FILE. */
+    size_t read_bytes;                  /* Bytes read from FILE, the rest is zero. */
+    bool readonly;
+    int mapid;                          /* Mapping id if created by mmap, else 0. */
+
+    struct list_elem elem;              /* Element in thread's vm_areas, sorted by START. */
+};
+
+/* Paging statistics of the whole system.  Each process also keeps
+   its own in struct thread.  Counters are not locked, an update
+   lost to a race now and then is tolerated. */
+extern struct vmstat vmstat_total;
+
+/* Counts an event of FIELD for process T and the system. */
+#define VMSTAT_COUNT(T, FIELD) ((T)->vmstat.FIELD++, vmstat_total.FIELD++)
+
+void page_init (void);
 void page_init_table (struct hash** page_table);
-bool page_copy_table (struct hash* from, struct hash* to);
+bool page_copy_table (struct list* from, struct list* to, struct file *exec_file);
+struct vm_area* vma_create (struct list* areas, uint8_t *start, size_t size,
+    struct file *file, off_t ofs, size_t read_bytes, bool read_only);
+struct vm_area* vma_find (struct list* areas, const void *addr);
+void vma_destroy (struct list* areas);
+bool page_grow_stack (void* fault_addr);
+int page_mmap (struct file *file, void *addr);
+bool page_munmap (int mapid);
 struct page_table_entry* page_create_and_insert_entry (struct hash* page_table, struct file *file, off_t ofs, uint8_t *upage,
     size_t page_read_bytes, size_t page_zero_bytes, bool read_only);
 struct page_table_entry* page_entry (struct file *file, off_t ofs, uint8_t *upage,
     size_t page_read_bytes, size_t page_zero_bytes, bool read_only);
 bool page_fault_handler (void* fault_addr, bool write);
+bool page_cow_handler (void* fault_addr);
+bool page_fork (struct thread *parent);
+bool page_pin (const void *uaddr, bool write);
+void page_unpin (const void *uaddr);
+void page_get_stats (struct vmstat *self, struct vmstat *total);
+void page_print_stats (void);
 
 hash_action_func page_free_entry;
 
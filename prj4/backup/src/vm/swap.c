@@ -1,10 +1,55 @@
 #include "swap.h"
 #include <debug.h>
+#include <stdio.h>
+#include <string.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
 
+static struct block *swap_block;
+static struct bitmap *swap_table;
+static uint16_t *swap_refs;             /* Entries sharing each slot, after fork. */
+
 struct lock swap_tb_lock, swap_blk_lock;
 
+/* Compressed swap tier.  A slot whose page compressed well keeps
+   its data in zswap_slots[] and is never written to the device;
+   the slot is still allocated in swap_table so that both tiers
+   share one index space. */
+size_t zswap_pages;
+static struct zswap_page **zswap_slots;
+static size_t zswap_used;               /* Bytes held by the pool. */
+static struct lock zswap_lock;          /* Guards the pool and codec state. */
+static long long zswap_stores, zswap_hits, zswap_misses;
+
+/* Readahead statistics, guarded by swap_tb_lock. */
+static long long readahead_reads, readahead_hits, readahead_wasted;
+
+struct zswap_page {
+    uint16_t size;                      /* Bytes of compressed data. */
+    uint8_t data[];
+};
+
+/* Pages that do not compress below this go to the swap device. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* LZ codec.  The stream is a sequence of tokens: a control byte
+   below 0x80 is followed by that many plus one literal bytes, any
+   other encodes a match of (c & 0x7f) + ZSWAP_MIN_MATCH bytes at the
+   2-byte distance that follows. */
+#define ZSWAP_MIN_MATCH 4
+#define ZSWAP_MAX_MATCH (0x7f + ZSWAP_MIN_MATCH)
+#define ZSWAP_MAX_LITERAL 0x80
+#define ZSWAP_HASH_BITS 10
+
+static uint16_t zswap_hash_table[1 << ZSWAP_HASH_BITS];
+static uint8_t zswap_buf[ZSWAP_MAX_SIZE];
+
+static size_t zswap_compress(const uint8_t *src, uint8_t *dst, size_t dst_size);
+static void zswap_decompress(const uint8_t *src, size_t size, uint8_t *dst);
+static bool zswap_store(size_t idx, const void *kpage);
+static bool zswap_load(size_t idx, void *kpage);
+static void zswap_drop(size_t idx);
+
 void init_swap_table(void){
     swap_block = block_get_role (BLOCK_SWAP);
     if(!swap_block) {
@@ -12,42 +57,288 @@ void init_swap_table(void){
     }
 
     swap_table = bitmap_create (block_size (swap_block) / SECTOR_PER_PAGE);
+    swap_refs = calloc (bitmap_size (swap_table), sizeof *swap_refs);
+    if (!swap_refs) {
+        bitmap_destroy (swap_table);
+        swap_table = NULL;
+        return;
+    }
     lock_init(&swap_tb_lock);
     lock_init(&swap_blk_lock);
+    lock_init(&zswap_lock);
+    if (zswap_pages > 0) {
+        zswap_slots = calloc (bitmap_size (swap_table), sizeof *zswap_slots);
+        if (!zswap_slots) zswap_pages = 0;
+    }
 }
 
-bool swap_out(struct page_table_entry* pte){
-    void* kpage = pte->kpage;
-    size_t idx = bitmap_scan_and_flip (swap_table, 0, 1, false);
+/* Writes the frames backing the CNT entries of PTES to a run of
+   adjacent swap slots, one multi-sector request per page, and
+   records each slot in its entry.  If no run of CNT free slots
+   exists, a shorter one is tried.  Returns the number of leading
+   entries of PTES that were written; unmapping the pages is up to
+   the caller, which knows the owning page directories. */
+size_t swap_out(struct page_table_entry **ptes, size_t cnt){
+    size_t idx = BITMAP_ERROR;
+
+    if (!swap_table) {
+        return 0;
+    }
+
+    lock_acquire(&swap_tb_lock);
+    for (; cnt > 0; cnt /= 2) {
+        idx = bitmap_scan_and_flip (swap_table, 0, cnt, false);
+        if (idx != BITMAP_ERROR) break;
+    }
+    for (size_t i = 0; idx != BITMAP_ERROR && i < cnt; i++)
+        swap_refs[idx + i] = 1;
+    lock_release(&swap_tb_lock);
     if (idx == BITMAP_ERROR) {
-        return false;
+        return 0;
     }
 
-    int mapping = idx * SECTOR_PER_PAGE;
-    for (int i = 0; i < SECTOR_PER_PAGE; i++)
-        block_write (swap_block, mapping + i, kpage + i * PGSIZE);
-    
-    pte->swap_idx = idx;
+    lock_acquire(&swap_blk_lock);
+    for (size_t i = 0; i < cnt; i++) {
+        if (!zswap_store(idx + i, ptes[i]->kpage))
+            block_write_multiple (swap_block, (idx + i) * SECTOR_PER_PAGE,
+                SECTOR_PER_PAGE, ptes[i]->kpage);
+        ptes[i]->swap_idx = idx + i;
+    }
+    lock_release(&swap_blk_lock);
 
-    pagedir_clear_page (thread_current()->pagedir, pte->upage);
-    
-    return true;
+    return cnt;
+}
+
+/* Reads swap slot IDX into KPAGE, from whichever tier holds it. */
+static void swap_read(size_t idx, void *kpage){
+    ASSERT(bitmap_test(swap_table, idx) == true);
+
+    if (!zswap_load(idx, kpage)) {
+        lock_acquire(&swap_blk_lock);
+        block_read_multiple (swap_block, idx * SECTOR_PER_PAGE, SECTOR_PER_PAGE, kpage);
+        lock_release(&swap_blk_lock);
+    }
 }
 
+/* Reads PTE's page from its swap slot into PTE->kpage.  The slot
+   is kept as a swap cache: until the page is dirtied, evicting it
+   again needs no write. */
 bool swap_in(struct page_table_entry* pte){
-    void* kpage = pte->kpage;
+    swap_read(pte->swap_idx, pte->kpage);
+    return true;
+}
+
+/* Reads the pages of the CNT entries of PTES from their swap slots
+   into their frames on speculation, as swap_in() does, and marks
+   them as readahead until swap_readahead_done() is called. */
+void swap_in_ahead(struct page_table_entry **ptes, size_t cnt){
+    for (size_t i = 0; i < cnt; i++) {
+        swap_read(ptes[i]->swap_idx, ptes[i]->kpage);
+        ptes[i]->readahead = true;
+    }
+
+    lock_acquire(&swap_tb_lock);
+    readahead_reads += cnt;
+    lock_release(&swap_tb_lock);
+}
+
+/* Settles the guess on PTE, if it was read ahead: a hit if the
+   page was USED, wasted if it is going away untouched. */
+void swap_readahead_done(struct page_table_entry *pte, bool used){
+    if (!pte->readahead) return;
+    pte->readahead = false;
 
-    size_t idx = pte->swap_idx;
+    lock_acquire(&swap_tb_lock);
+    if (used)
+        readahead_hits++;
+    else
+        readahead_wasted++;
+    lock_release(&swap_tb_lock);
+}
+
+/* Drops a reference to swap slot IDX, releasing the slot with
+   the last one. */
+void swap_free(size_t idx){
+    bool last;
+
+    lock_acquire(&swap_tb_lock);
     ASSERT(bitmap_test(swap_table, idx) == true);
+    ASSERT(swap_refs[idx] > 0);
+    last = --swap_refs[idx] == 0;
+    lock_release(&swap_tb_lock);
+    if (!last) return;
 
+    zswap_drop(idx);
+    lock_acquire(&swap_tb_lock);
     bitmap_set(swap_table, idx, false);
-    int mapping = idx * SECTOR_PER_PAGE;
-    for (int i = 0; i < SECTOR_PER_PAGE; i++)
-        block_read (swap_block, mapping + i, kpage + i * PGSIZE);
-    
-    return true;
+    lock_release(&swap_tb_lock);
+}
+
+/* Adds a reference to swap slot IDX, for an entry of a forked
+   process sharing the page. */
+void swap_dup(size_t idx){
+    lock_acquire(&swap_tb_lock);
+    ASSERT(bitmap_test(swap_table, idx) == true);
+    ASSERT(swap_refs[idx] < UINT16_MAX);
+    swap_refs[idx]++;
+    lock_release(&swap_tb_lock);
 }
 
 void free_swap_table(void){
     bitmap_destroy(swap_table);
-}
\ No newline at end of file
+}
+
+void swap_print_stats(void){
+    long long loads = zswap_hits + zswap_misses;
+
+    if (readahead_reads > 0)
+        printf ("Swap readahead: %lld pages read, %lld used, %lld wasted\n",
+                readahead_reads, readahead_hits, readahead_wasted);
+    if (!zswap_slots) return;
+    printf ("Compressed swap: %lld pages stored, %lld of %lld swap-ins hit (%lld%%), "
+            "%zu bytes in use\n", zswap_stores, zswap_hits, loads,
+            loads ? zswap_hits * 100 / loads : 0, zswap_used);
+}
+
+/* Compresses the page at KPAGE into swap slot IDX of the pool.
+   Returns false if the pool is disabled, full, or the page does not
+   compress, in which case the caller writes it to the device. */
+static bool zswap_store(size_t idx, const void *kpage){
+    struct zswap_page *zp = NULL;
+    size_t size;
+
+    if (!zswap_slots) return false;
+
+    lock_acquire(&zswap_lock);
+    ASSERT(zswap_slots[idx] == NULL);
+    size = zswap_compress(kpage, zswap_buf, sizeof zswap_buf);
+    if (size > 0 && zswap_used + size <= zswap_pages * PGSIZE)
+        zp = malloc(sizeof *zp + size);
+    if (zp) {
+        zp->size = size;
+        memcpy(zp->data, zswap_buf, size);
+        zswap_slots[idx] = zp;
+        zswap_used += size;
+        zswap_stores++;
+    }
+    lock_release(&zswap_lock);
+
+    return zp != NULL;
+}
+
+/* Decompresses slot IDX into KPAGE if it lives in the pool.  The
+   slot itself is released by swap_free(). */
+static bool zswap_load(size_t idx, void *kpage){
+    bool hit;
+
+    if (!zswap_slots) return false;
+
+    lock_acquire(&zswap_lock);
+    hit = zswap_slots[idx] != NULL;
+    if (hit) {
+        zswap_decompress(zswap_slots[idx]->data, zswap_slots[idx]->size, kpage);
+        zswap_hits++;
+    } else
+        zswap_misses++;
+    lock_release(&zswap_lock);
+
+    return hit;
+}
+
+static void zswap_drop(size_t idx){
+    if (!zswap_slots) return;
+
+    lock_acquire(&zswap_lock);
+    if (zswap_slots[idx]) {
+        zswap_used -= zswap_slots[idx]->size;
+        free(zswap_slots[idx]);
+        zswap_slots[idx] = NULL;
+    }
+    lock_release(&zswap_lock);
+}
+
+static unsigned zswap_hash(const uint8_t *p){
+    uint32_t v;
+
+    memcpy(&v, p, sizeof v);
+    return (v * 2654435761u) >> (32 - ZSWAP_HASH_BITS);
+}
+
+/* Flushes the CNT literals ending at END into DST at *OUT.
+   Returns false if DST_SIZE would be exceeded. */
+static bool zswap_put_literals(const uint8_t *end, size_t cnt,
+                               uint8_t *dst, size_t *out, size_t dst_size){
+    while (cnt > 0) {
+        size_t n = cnt < ZSWAP_MAX_LITERAL ? cnt : ZSWAP_MAX_LITERAL;
+
+        if (*out + 1 + n > dst_size) return false;
+        dst[(*out)++] = n - 1;
+        memcpy(dst + *out, end - cnt, n);
+        *out += n;
+        cnt -= n;
+    }
+    return true;
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed
+   size, or 0 if it would not fit in DST_SIZE bytes. */
+static size_t zswap_compress(const uint8_t *src, uint8_t *dst, size_t dst_size){
+    size_t pos = 0, lit = 0, out = 0;
+
+    /* Positions are stored plus one so that zero means empty. */
+    memset(zswap_hash_table, 0, sizeof zswap_hash_table);
+    while (pos + ZSWAP_MIN_MATCH <= PGSIZE) {
+        unsigned h = zswap_hash(src + pos);
+        size_t cand = zswap_hash_table[h], len = 0;
+
+        zswap_hash_table[h] = pos + 1;
+        if (cand > 0) {
+            cand--;
+            while (pos + len < PGSIZE && len < ZSWAP_MAX_MATCH
+                   && src[cand + len] == src[pos + len])
+                len++;
+        }
+        if (len < ZSWAP_MIN_MATCH) {
+            pos++;
+            lit++;
+            continue;
+        }
+
+        if (!zswap_put_literals(src + pos, lit, dst, &out, dst_size)
+            || out + 3 > dst_size)
+            return 0;
+        lit = 0;
+        dst[out++] = 0x80 | (len - ZSWAP_MIN_MATCH);
+        dst[out++] = (pos - cand) & 0xff;
+        dst[out++] = (pos - cand) >> 8;
+        pos += len;
+    }
+    lit += PGSIZE - pos;
+    if (!zswap_put_literals(src + PGSIZE, lit, dst, &out, dst_size))
+        return 0;
+    return out;
+}
+
+static void zswap_decompress(const uint8_t *src, size_t size, uint8_t *dst){
+    const uint8_t *end = src + size;
+    uint8_t *out = dst;
+
+    while (src < end) {
+        uint8_t c = *src++;
+
+        if (c < 0x80) {
+            memcpy(out, src, c + 1);
+            out += c + 1;
+            src += c + 1;
+        } else {
+            size_t len = (c & 0x7f) + ZSWAP_MIN_MATCH;
+            size_t dist = src[0] | (src[1] << 8);
+
+            src += 2;
+            /* Byte by byte: a match may overlap its own output. */
+            for (; len > 0; len--, out++)
+                *out = *(out - dist);
+        }
+    }
+    ASSERT(out == dst + PGSIZE);
+}
@@ -8,14 +8,21 @@
 #include "vm/frame.h"
 #include "threads/vaddr.h"
 
-struct block *swap_block;
-struct bitmap *swap_table;
-
 #define SECTOR_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Budget of the compressed in-RAM swap tier, in pages of kernel
+   memory.  Zero, the default, disables it.  Set by the kernel
+   command line option "-zswap". */
+extern size_t zswap_pages;
+
 void init_swap_table(void);
-bool swap_out(struct page_table_entry* pte);
+size_t swap_out(struct page_table_entry **ptes, size_t cnt);
 bool swap_in(struct page_table_entry* pte);
+void swap_in_ahead(struct page_table_entry **ptes, size_t cnt);
+void swap_readahead_done(struct page_table_entry *pte, bool used);
+void swap_free(size_t idx);
+void swap_dup(size_t idx);
 void free_swap_table(void);
+void swap_print_stats(void);
 
 #endif
\ No newline at end of file